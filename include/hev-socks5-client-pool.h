@@ -0,0 +1 @@
+../src/hev-socks5-client-pool.h
\ No newline at end of file
@@ -0,0 +1 @@
+../src/hev-socks5-client-upstream.h
\ No newline at end of file
@@ -0,0 +1 @@
+../src/hev-socks5-router.h
\ No newline at end of file
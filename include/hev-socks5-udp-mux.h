@@ -0,0 +1 @@
+../src/hev-socks5-udp-mux.h
\ No newline at end of file
@@ -0,0 +1,29 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-admission-priv.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Admission Private
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_ADMISSION_PRIV_H__
+#define __HEV_SOCKS5_ADMISSION_PRIV_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Admits the client on fd into the handshake, or returns -1 when too many
+ * handshakes are in flight or its address is over its rate. Every admitted
+ * handshake must be left once it is done.
+ */
+int hev_socks5_admission_enter (int fd);
+void hev_socks5_admission_leave (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_SOCKS5_ADMISSION_PRIV_H__ */
@@ -0,0 +1,149 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-admission.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Admission
+ ============================================================================
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "hev-socks5-misc-priv.h"
+#include "hev-socks5-table-priv.h"
+
+#include "hev-socks5-admission-priv.h"
+
+typedef struct _HevSocks5AdmissionBucket HevSocks5AdmissionBucket;
+
+struct _HevSocks5AdmissionBucket
+{
+    int64_t tokens; /* thousandths */
+    int64_t stamp;
+};
+
+static int handshake_limit;
+static int client_rate;
+static int client_burst;
+static unsigned int inflight;
+static unsigned int capped;
+static unsigned int limited;
+static HevSocks5Table *buckets;
+
+static int
+hev_socks5_admission_take (void *value, int fresh, void *data)
+{
+    HevSocks5AdmissionBucket *b = value;
+    int64_t now = *(int64_t *)data;
+    int64_t max = (int64_t)client_burst * 1000;
+
+    if (fresh)
+        b->tokens = max;
+    else
+        b->tokens += (now - b->stamp) * client_rate;
+    if (b->tokens > max)
+        b->tokens = max;
+    b->stamp = now;
+
+    if (b->tokens < 1000)
+        return -1;
+
+    b->tokens -= 1000;
+    return 0;
+}
+
+static int
+hev_socks5_admission_check_rate (int fd)
+{
+    struct sockaddr_in6 addr;
+    socklen_t alen = sizeof (addr);
+    HevSocks5Table *table;
+    int64_t now;
+    int res;
+
+    table = __atomic_load_n (&buckets, __ATOMIC_ACQUIRE);
+    if (!table)
+        return 0;
+
+    res = getpeername (fd, (struct sockaddr *)&addr, &alen);
+    if (res < 0 || addr.sin6_family != AF_INET6)
+        return 0;
+
+    /* one bucket per address, or per /64 for IPv6, whatever the port */
+    addr.sin6_port = 0;
+    if (!IN6_IS_ADDR_V4MAPPED (&addr.sin6_addr))
+        memset (&addr.sin6_addr.s6_addr[8], 0, 8);
+    now = hev_socks5_now ();
+
+    return hev_socks5_table_apply (table, &addr, hev_socks5_admission_take,
+                                   &now);
+}
+
+int
+hev_socks5_admission_enter (int fd)
+{
+    unsigned int n;
+
+    /* cheapest first: no lookups while over the cap */
+    /* rejections are counted, not logged, since they come in floods */
+    n = __atomic_add_fetch (&inflight, 1, __ATOMIC_RELAXED);
+    if (handshake_limit > 0 && n > (unsigned int)handshake_limit) {
+        __atomic_sub_fetch (&inflight, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch (&capped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    if (hev_socks5_admission_check_rate (fd) < 0) {
+        __atomic_sub_fetch (&inflight, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch (&limited, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+hev_socks5_admission_leave (void)
+{
+    __atomic_sub_fetch (&inflight, 1, __ATOMIC_RELAXED);
+}
+
+void
+hev_socks5_set_handshake_limit (int limit)
+{
+    handshake_limit = limit;
+}
+
+int
+hev_socks5_set_client_rate_limit (int rate, int burst, int size)
+{
+    HevSocks5Table *table;
+
+    if (buckets)
+        return -1;
+
+    if (rate <= 0)
+        return 0;
+
+    table = hev_socks5_table_new (size, sizeof (HevSocks5AdmissionBucket));
+    if (!table)
+        return -1;
+
+    client_rate = rate;
+    client_burst = (burst > 0) ? burst : 1;
+    __atomic_store_n (&buckets, table, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+void
+hev_socks5_get_admission_stats (unsigned int *handshakes,
+                                unsigned int *over_limit,
+                                unsigned int *over_rate)
+{
+    *handshakes = __atomic_load_n (&inflight, __ATOMIC_RELAXED);
+    *over_limit = __atomic_load_n (&capped, __ATOMIC_RELAXED);
+    *over_rate = __atomic_load_n (&limited, __ATOMIC_RELAXED);
+}
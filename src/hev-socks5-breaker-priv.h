@@ -0,0 +1,45 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-breaker-priv.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Breaker Private
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_BREAKER_PRIV_H__
+#define __HEV_SOCKS5_BREAKER_PRIV_H__
+
+#include <netinet/in.h>
+
+#include "hev-socks5-proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fills the key a target is tracked by: its address for IP literals, a
+ * hash of its name for names, so the check can come before resolving.
+ */
+void hev_socks5_breaker_key (const HevSocks5Addr *addr,
+                             struct sockaddr_in6 *key);
+
+/*
+ * Returns 0 when a connect to dest may go ahead, or -1 to fail it fast
+ * while dest is backing off or has too many connects pending. Every
+ * connect let through must be left, with the address that connected or
+ * NULL and the addresses tried when it failed, or cancelled when it was
+ * abandoned before either.
+ */
+int hev_socks5_breaker_enter (const struct sockaddr_in6 *dest);
+void hev_socks5_breaker_leave (const struct sockaddr_in6 *dest,
+                               const struct sockaddr_in6 *peer,
+                               const struct sockaddr_in6 *addrs, int nums);
+void hev_socks5_breaker_cancel (const struct sockaddr_in6 *dest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_SOCKS5_BREAKER_PRIV_H__ */
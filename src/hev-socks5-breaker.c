@@ -0,0 +1,255 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-breaker.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Breaker
+ ============================================================================
+ */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hev-socks5-misc-priv.h"
+#include "hev-socks5-table-priv.h"
+
+#include "hev-socks5-breaker-priv.h"
+
+typedef struct _HevSocks5BreakerState HevSocks5BreakerState;
+typedef struct _HevSocks5BreakerCall HevSocks5BreakerCall;
+
+struct _HevSocks5BreakerState
+{
+    int failures;
+    int pending;
+    int probing;
+    int64_t failed;
+    int64_t opened; /* 0: closed */
+};
+
+struct _HevSocks5BreakerCall
+{
+    int release;
+    int outcome; /* -1: none, 0: failure, 1: success */
+    int64_t now;
+};
+
+static int breaker_failures;
+static int breaker_backoff;
+static int breaker_pending;
+static unsigned int tripped;
+static unsigned int rejected;
+static HevSocks5Table *states;
+
+static int
+hev_socks5_breaker_admit (void *value, int fresh, void *data)
+{
+    HevSocks5BreakerState *s = value;
+    HevSocks5BreakerCall *call = data;
+
+    if (breaker_pending && s->pending >= breaker_pending)
+        return -1;
+
+    if (s->opened) {
+        if ((call->now - s->opened) < breaker_backoff)
+            return -1;
+
+        /* backed off: one probe at a time finds out if dest is back */
+        if (s->probing)
+            return -1;
+        s->probing = 1;
+    }
+
+    s->pending++;
+    return 0;
+}
+
+static int
+hev_socks5_breaker_settle (void *value, int fresh, void *data)
+{
+    HevSocks5BreakerState *s = value;
+    HevSocks5BreakerCall *call = data;
+
+    if (call->release && s->pending)
+        s->pending--;
+
+    /* an abandoned probe leaves the breaker open for the next one */
+    if (call->outcome < 0) {
+        s->probing = 0;
+        return 0;
+    }
+
+    if (call->outcome) {
+        s->failures = 0;
+        s->probing = 0;
+        s->opened = 0;
+        return 0;
+    }
+
+    /* failures only add up while they keep coming within the backoff */
+    if ((call->now - s->failed) >= breaker_backoff)
+        s->failures = 0;
+    s->failures++;
+    s->failed = call->now;
+
+    if (s->probing ||
+        (!s->opened && breaker_failures && s->failures >= breaker_failures)) {
+        s->probing = 0;
+        s->opened = call->now;
+        return 1;
+    }
+
+    return 0;
+}
+
+void
+hev_socks5_breaker_key (const HevSocks5Addr *addr, struct sockaddr_in6 *key)
+{
+    uint64_t hash = 14695981039346656037ull;
+    int i;
+
+    memset (key, 0, sizeof (struct sockaddr_in6));
+    key->sin6_family = AF_INET6;
+
+    switch (addr->atype) {
+    case HEV_SOCKS5_ADDR_TYPE_IPV4:
+        key->sin6_addr.s6_addr[10] = 0xff;
+        key->sin6_addr.s6_addr[11] = 0xff;
+        memcpy (&key->sin6_addr.s6_addr[12], addr->ipv4.addr, 4);
+        key->sin6_port = addr->ipv4.port;
+        break;
+    case HEV_SOCKS5_ADDR_TYPE_IPV6:
+        memcpy (&key->sin6_addr, addr->ipv6.addr, 16);
+        key->sin6_port = addr->ipv6.port;
+        break;
+    case HEV_SOCKS5_ADDR_TYPE_NAME:
+        /* names map into the discard prefix 100::/64 by their hash */
+        for (i = 0; i < addr->domain.len; i++) {
+            hash ^= tolower (addr->domain.addr[i]);
+            hash *= 1099511628211ull;
+        }
+        key->sin6_addr.s6_addr[0] = 0x01;
+        for (i = 0; i < 8; i++)
+            key->sin6_addr.s6_addr[8 + i] = hash >> (i * 8);
+        memcpy (&key->sin6_port, &addr->domain.addr[addr->domain.len], 2);
+        break;
+    }
+}
+
+int
+hev_socks5_breaker_enter (const struct sockaddr_in6 *dest)
+{
+    HevSocks5BreakerCall call;
+    HevSocks5Table *table;
+    int res;
+
+    table = __atomic_load_n (&states, __ATOMIC_ACQUIRE);
+    if (!table)
+        return 0;
+
+    call.now = hev_socks5_now ();
+    res = hev_socks5_table_apply (table, dest, hev_socks5_breaker_admit,
+                                  &call);
+    if (res < 0)
+        __atomic_add_fetch (&rejected, 1, __ATOMIC_RELAXED);
+
+    return res;
+}
+
+static void
+hev_socks5_breaker_settle_key (HevSocks5Table *table,
+                               const struct sockaddr_in6 *key, int release,
+                               int outcome)
+{
+    HevSocks5BreakerCall call;
+    int res;
+
+    call.now = hev_socks5_now ();
+    call.release = release;
+    call.outcome = outcome;
+    res = hev_socks5_table_apply (table, key, hev_socks5_breaker_settle,
+                                  &call);
+    if (res > 0)
+        __atomic_add_fetch (&tripped, 1, __ATOMIC_RELAXED);
+}
+
+static int
+hev_socks5_breaker_same (const struct sockaddr_in6 *a,
+                         const struct sockaddr_in6 *b)
+{
+    return a->sin6_port == b->sin6_port &&
+           memcmp (&a->sin6_addr, &b->sin6_addr, 16) == 0;
+}
+
+void
+hev_socks5_breaker_leave (const struct sockaddr_in6 *dest,
+                          const struct sockaddr_in6 *peer,
+                          const struct sockaddr_in6 *addrs, int nums)
+{
+    HevSocks5Table *table;
+    int i;
+
+    table = __atomic_load_n (&states, __ATOMIC_ACQUIRE);
+    if (!table)
+        return;
+
+    /* a name connects through one of its addresses, which is credited too */
+    if (peer) {
+        hev_socks5_breaker_settle_key (table, dest, 1, 1);
+        if (!hev_socks5_breaker_same (dest, peer))
+            hev_socks5_breaker_settle_key (table, peer, 0, 1);
+        return;
+    }
+
+    /* every address was tried, so each of them failed */
+    hev_socks5_breaker_settle_key (table, dest, 1, 0);
+    for (i = 0; i < nums; i++) {
+        if (!hev_socks5_breaker_same (dest, &addrs[i]))
+            hev_socks5_breaker_settle_key (table, &addrs[i], 0, 0);
+    }
+}
+
+void
+hev_socks5_breaker_cancel (const struct sockaddr_in6 *dest)
+{
+    HevSocks5Table *table;
+
+    table = __atomic_load_n (&states, __ATOMIC_ACQUIRE);
+    if (!table)
+        return;
+
+    hev_socks5_breaker_settle_key (table, dest, 1, -1);
+}
+
+int
+hev_socks5_set_connect_breaker (int failures, int backoff, int pending,
+                                int size)
+{
+    HevSocks5Table *table;
+
+    if (states)
+        return -1;
+
+    if (failures <= 0 && pending <= 0)
+        return 0;
+
+    table = hev_socks5_table_new (size, sizeof (HevSocks5BreakerState));
+    if (!table)
+        return -1;
+
+    breaker_failures = (failures > 0) ? failures : 0;
+    breaker_backoff = backoff;
+    breaker_pending = pending;
+    __atomic_store_n (&states, table, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+void
+hev_socks5_get_connect_breaker_stats (unsigned int *trips,
+                                      unsigned int *rejects)
+{
+    *trips = __atomic_load_n (&tripped, __ATOMIC_RELAXED);
+    *rejects = __atomic_load_n (&rejected, __ATOMIC_RELAXED);
+}
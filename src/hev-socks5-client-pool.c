@@ -0,0 +1,368 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-client-pool.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Client Pool
+ ============================================================================
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-io-socket.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-socks5-misc-priv.h"
+#include "hev-socks5-logger-priv.h"
+#include "hev-socks5-client-priv.h"
+
+#include "hev-socks5-client-pool.h"
+
+#define REFILL_RETRIES 3
+
+HevSocks5ClientPool *
+hev_socks5_client_pool_new (const char *addr, int port, int size)
+{
+    HevSocks5ClientPool *self;
+    int res;
+
+    self = hev_malloc0 (sizeof (HevSocks5ClientPool));
+    if (!self)
+        return NULL;
+
+    res = hev_socks5_client_pool_construct (self, addr, port, size);
+    if (res < 0) {
+        hev_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p socks5 client pool new", self);
+
+    return self;
+}
+
+int
+hev_socks5_client_pool_set_auth (HevSocks5ClientPool *self, const char *user,
+                                 const char *pass)
+{
+    char *u, *p;
+
+    LOG_D ("%p socks5 client pool set auth", self);
+
+    u = hev_socks5_strdup (user);
+    if (!u)
+        return -1;
+
+    p = hev_socks5_strdup (pass);
+    if (!p) {
+        hev_free (u);
+        return -1;
+    }
+
+    if (self->auth.user)
+        hev_free (self->auth.user);
+    if (self->auth.pass)
+        hev_free (self->auth.pass);
+
+    self->auth.user = u;
+    self->auth.pass = p;
+
+    return 0;
+}
+
+void
+hev_socks5_client_pool_set_idle_timeout (HevSocks5ClientPool *self,
+                                         int timeout)
+{
+    self->idle_timeout = timeout;
+}
+
+static int
+hev_socks5_client_pool_alive (int fd)
+{
+    ssize_t res;
+    char c;
+
+    /* idle connections must neither be closed nor carry data */
+    res = recv (fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (res < 0 && errno == EAGAIN)
+        return 1;
+
+    return 0;
+}
+
+static void
+hev_socks5_client_pool_prune (HevSocks5ClientPool *self)
+{
+    int64_t now = hev_socks5_now ();
+    int i, n = 0;
+
+    for (i = 0; i < self->nums; i++) {
+        HevSocks5ClientPoolConn *conn = &self->conns[i];
+
+        if ((now - conn->stamp) < self->idle_timeout &&
+            hev_socks5_client_pool_alive (conn->fd))
+            self->conns[n++] = *conn;
+        else
+            close (conn->fd);
+    }
+
+    self->nums = n;
+}
+
+static void
+hev_socks5_client_pool_put (HevSocks5ClientPool *self, int fd)
+{
+    HevSocks5ClientPoolConn *conn;
+
+    if (self->nums >= self->size) {
+        close (fd);
+        return;
+    }
+
+    conn = &self->conns[self->nums++];
+    conn->fd = fd;
+    conn->stamp = hev_socks5_now ();
+}
+
+static int
+hev_socks5_client_pool_take (HevSocks5ClientPool *self)
+{
+    int64_t now = hev_socks5_now ();
+
+    while (self->nums > 0) {
+        HevSocks5ClientPoolConn *conn = &self->conns[--self->nums];
+
+        if ((now - conn->stamp) < self->idle_timeout &&
+            hev_socks5_client_pool_alive (conn->fd))
+            return conn->fd;
+
+        close (conn->fd);
+    }
+
+    return -1;
+}
+
+static int
+hev_socks5_client_pool_dial (HevSocks5ClientPool *self,
+                             HevSocks5Client *client)
+{
+    int res;
+
+    if (!self->resolved) {
+        memset (&self->saddr, 0, sizeof (self->saddr));
+        self->family = hev_socks5_get_addr_family (HEV_SOCKS5 (client));
+        res = hev_socks5_name_into_sockaddr6 (self->addr, self->port,
+                                              &self->saddr, &self->family);
+        if (res < 0) {
+            LOG_I ("%p socks5 client pool resolve [%s]:%d", self, self->addr,
+                   self->port);
+            return -1;
+        }
+        self->resolved = 1;
+    }
+
+    res = hev_socks5_client_connect_sockaddr (client, &self->saddr,
+                                              self->family);
+    if (res < 0) {
+        self->resolved = 0;
+        return -1;
+    }
+
+    /* credentials the caller set on its client take precedence */
+    if (!client->auth.user)
+        hev_socks5_client_set_auth (client, self->auth.user, self->auth.pass);
+
+    return 0;
+}
+
+static void
+hev_socks5_client_pool_refill_entry (void *data)
+{
+    HevSocks5ClientPool *self = data;
+    int fails = 0;
+
+    LOG_D ("%p socks5 client pool refill", self);
+
+    while (self->nums < self->size && fails < REFILL_RETRIES) {
+        HevSocks5Client *client;
+        int res;
+
+        client = hev_malloc0 (sizeof (HevSocks5Client));
+        if (!client)
+            break;
+
+        res = hev_socks5_client_construct (client, HEV_SOCKS5_TYPE_NONE);
+        if (res < 0) {
+            hev_free (client);
+            break;
+        }
+
+        res = hev_socks5_client_pool_dial (self, client);
+        if (res == 0)
+            res = hev_socks5_client_negotiate (client);
+        if (res == 0) {
+            int fd = HEV_SOCKS5 (client)->fd;
+
+            hev_task_del_fd (hev_task_self (), fd);
+            HEV_SOCKS5 (client)->fd = -1;
+            hev_socks5_client_pool_put (self, fd);
+            fails = 0;
+        } else {
+            fails++;
+        }
+
+        hev_object_unref (HEV_OBJECT (client));
+
+        if (fails)
+            hev_task_sleep (fails * 1000);
+    }
+
+    self->refilling = 0;
+    hev_object_unref (HEV_OBJECT (self));
+}
+
+void
+hev_socks5_client_pool_warm (HevSocks5ClientPool *self)
+{
+    HevTask *task;
+
+    hev_socks5_client_pool_prune (self);
+
+    if (self->refilling || self->nums >= self->size)
+        return;
+
+    task = hev_task_new (hev_socks5_get_task_stack_size ());
+    if (!task)
+        return;
+
+    LOG_D ("%p socks5 client pool warm", self);
+
+    self->refilling = 1;
+    hev_object_ref (HEV_OBJECT (self));
+    hev_task_run (task, hev_socks5_client_pool_refill_entry, self);
+}
+
+static int
+hev_socks5_client_pool_auth_match (HevSocks5ClientPool *self,
+                                   HevSocks5Client *client)
+{
+    if (!client->auth.user)
+        return 1;
+
+    if (!self->auth.user || strcmp (client->auth.user, self->auth.user) ||
+        strcmp (client->auth.pass, self->auth.pass))
+        return 0;
+
+    return 1;
+}
+
+int
+hev_socks5_client_pool_connect (HevSocks5ClientPool *self,
+                                HevSocks5Client *client)
+{
+    HevTask *task = hev_task_self ();
+    int res;
+    int fd;
+
+    LOG_D ("%p socks5 client pool connect %p", self, client);
+
+    /*
+     * Pooled connections are authenticated as the pool. A dialed one is left
+     * unauthenticated, so the handshake can pipeline auth with the request.
+     */
+    if (!hev_socks5_client_pool_auth_match (self, client))
+        return hev_socks5_client_pool_dial (self, client);
+
+    fd = hev_socks5_client_pool_take (self);
+    hev_socks5_client_pool_warm (self);
+
+    if (fd < 0)
+        return hev_socks5_client_pool_dial (self, client);
+
+    res = hev_task_add_fd (task, fd, POLLIN | POLLOUT);
+    if (res < 0)
+        hev_task_mod_fd (task, fd, POLLIN | POLLOUT);
+
+    HEV_SOCKS5 (client)->fd = fd;
+    hev_socks5_set_addr_family (HEV_SOCKS5 (client), self->family);
+    client->authed = 1;
+
+    return 0;
+}
+
+int
+hev_socks5_client_pool_construct (HevSocks5ClientPool *self, const char *addr,
+                                  int port, int size)
+{
+    int res;
+
+    res = hev_object_construct (&self->base);
+    if (res < 0)
+        return res;
+
+    LOG_D ("%p socks5 client pool construct", self);
+
+    HEV_OBJECT (self)->klass = HEV_SOCKS5_CLIENT_POOL_TYPE;
+
+    self->addr = hev_socks5_strdup (addr);
+    if (!self->addr)
+        return -1;
+
+    self->conns = hev_malloc0 (sizeof (HevSocks5ClientPoolConn) * size);
+    if (!self->conns) {
+        hev_free (self->addr);
+        return -1;
+    }
+
+    self->port = port;
+    self->size = size;
+    self->idle_timeout = 30000;
+    self->family = HEV_SOCKS5_ADDR_FAMILY_UNSPEC;
+
+    return 0;
+}
+
+static void
+hev_socks5_client_pool_destruct (HevObject *base)
+{
+    HevSocks5ClientPool *self = HEV_SOCKS5_CLIENT_POOL (base);
+    int i;
+
+    LOG_D ("%p socks5 client pool destruct", self);
+
+    for (i = 0; i < self->nums; i++)
+        close (self->conns[i].fd);
+
+    if (self->auth.user)
+        hev_free (self->auth.user);
+    if (self->auth.pass)
+        hev_free (self->auth.pass);
+
+    hev_free (self->conns);
+    hev_free (self->addr);
+
+    HEV_OBJECT_TYPE->destruct (base);
+    hev_free (base);
+}
+
+HevObjectClass *
+hev_socks5_client_pool_class (void)
+{
+    static HevSocks5ClientPoolClass klass;
+    HevSocks5ClientPoolClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        memcpy (kptr, HEV_OBJECT_TYPE, sizeof (HevObjectClass));
+
+        okptr->name = "HevSocks5ClientPool";
+        okptr->destruct = hev_socks5_client_pool_destruct;
+    }
+
+    return okptr;
+}
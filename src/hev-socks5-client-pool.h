@@ -0,0 +1,95 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-client-pool.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Client Pool
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_CLIENT_POOL_H__
+#define __HEV_SOCKS5_CLIENT_POOL_H__
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include <hev-object.h>
+
+#include "hev-socks5-client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_SOCKS5_CLIENT_POOL(p) ((HevSocks5ClientPool *)p)
+#define HEV_SOCKS5_CLIENT_POOL_CLASS(p) ((HevSocks5ClientPoolClass *)p)
+#define HEV_SOCKS5_CLIENT_POOL_TYPE (hev_socks5_client_pool_class ())
+
+typedef struct _HevSocks5ClientPool HevSocks5ClientPool;
+typedef struct _HevSocks5ClientPoolConn HevSocks5ClientPoolConn;
+typedef struct _HevSocks5ClientPoolClass HevSocks5ClientPoolClass;
+
+struct _HevSocks5ClientPoolConn
+{
+    int fd;
+    int64_t stamp;
+};
+
+/*
+ * Keeps idle connections to one socks5 server that are already past method
+ * negotiation and username/password authentication. A pool is owned by the
+ * task system of the thread that created it.
+ */
+struct _HevSocks5ClientPool
+{
+    HevObject base;
+
+    char *addr;
+    int port;
+    int size;
+    int nums;
+    int family;
+    int resolved;
+    int refilling;
+    int idle_timeout;
+
+    struct sockaddr_in6 saddr;
+
+    struct
+    {
+        char *user;
+        char *pass;
+    } auth;
+
+    HevSocks5ClientPoolConn *conns;
+};
+
+struct _HevSocks5ClientPoolClass
+{
+    HevObjectClass base;
+};
+
+HevObjectClass *hev_socks5_client_pool_class (void);
+
+int hev_socks5_client_pool_construct (HevSocks5ClientPool *self,
+                                      const char *addr, int port, int size);
+
+HevSocks5ClientPool *hev_socks5_client_pool_new (const char *addr, int port,
+                                                 int size);
+
+int hev_socks5_client_pool_set_auth (HevSocks5ClientPool *self,
+                                     const char *user, const char *pass);
+
+void hev_socks5_client_pool_set_idle_timeout (HevSocks5ClientPool *self,
+                                              int timeout);
+
+void hev_socks5_client_pool_warm (HevSocks5ClientPool *self);
+
+int hev_socks5_client_pool_connect (HevSocks5ClientPool *self,
+                                    HevSocks5Client *client);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_SOCKS5_CLIENT_POOL_H__ */
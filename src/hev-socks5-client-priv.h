@@ -0,0 +1,34 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-client-priv.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Client Private
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_CLIENT_PRIV_H__
+#define __HEV_SOCKS5_CLIENT_PRIV_H__
+
+#include <netinet/in.h>
+
+#include "hev-socks5-client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int hev_socks5_client_connect_sockaddr (HevSocks5Client *self,
+                                        struct sockaddr_in6 *saddr,
+                                        int family);
+
+int hev_socks5_client_negotiate (HevSocks5Client *self);
+
+/* like handshake, but -2 when the server replied with an error */
+int hev_socks5_client_request (HevSocks5Client *self, int pipeline);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_SOCKS5_CLIENT_PRIV_H__ */
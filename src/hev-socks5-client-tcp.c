@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-socks5-client-tcp.c
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2021 - 2025 hev
+ Copyright   : Copyright (c) 2021 - 2026 hev
  Description : Socks5 Client TCP
  ============================================================================
  */
@@ -85,6 +85,18 @@ hev_socks5_client_tcp_new_ipv6 (const void *ipv6, int port)
     return self;
 }
 
+void
+hev_socks5_client_tcp_set_early_data (HevSocks5ClientTCP *self,
+                                      const void *data, size_t len)
+{
+    HevSocks5Client *base = HEV_SOCKS5_CLIENT (self);
+
+    LOG_D ("%p socks5 client tcp set early data %zu", self, len);
+
+    base->early.data = data;
+    base->early.len = len;
+}
+
 static HevSocks5Addr *
 hev_socks5_client_tcp_get_upstream_addr (HevSocks5Client *base)
 {
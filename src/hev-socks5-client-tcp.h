@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-socks5-client-tcp.h
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2021 - 2025 hev
+ Copyright   : Copyright (c) 2021 - 2026 hev
  Description : Socks5 Client TCP
  ============================================================================
  */
@@ -49,6 +49,14 @@ HevSocks5ClientTCP *hev_socks5_client_tcp_new_name (const char *name, int port);
 HevSocks5ClientTCP *hev_socks5_client_tcp_new_ipv4 (const void *ipv4, int port);
 HevSocks5ClientTCP *hev_socks5_client_tcp_new_ipv6 (const void *ipv6, int port);
 
+/*
+ * Queues the first payload to be sent right after the CONNECT request, in
+ * the same write. The buffer must stay valid until the handshake returns;
+ * if the handshake fails, the payload may already have been delivered.
+ */
+void hev_socks5_client_tcp_set_early_data (HevSocks5ClientTCP *self,
+                                           const void *data, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,761 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-client-upstream.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Client Upstream
+ ============================================================================
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hev-task.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-socks5-misc-priv.h"
+#include "hev-socks5-logger-priv.h"
+#include "hev-socks5-client-priv.h"
+
+#include "hev-socks5-client-upstream.h"
+
+#define MAX_FAILS 3
+#define FAIL_TIMEOUT 10000
+#define HEDGE_DELAY 250
+#define HEDGE_MIN_SAMPLES 8
+
+typedef struct _HevSocks5ClientUpstreamRace HevSocks5ClientUpstreamRace;
+typedef struct _HevSocks5ClientUpstreamAttempt HevSocks5ClientUpstreamAttempt;
+
+struct _HevSocks5ClientUpstreamAttempt
+{
+    int id;
+    int running;
+    int cancelled;
+
+    HevTask *task;
+    HevSocks5Client *client;
+    HevSocks5ClientUpstreamRace *race;
+};
+
+struct _HevSocks5ClientUpstreamRace
+{
+    int refs;
+    int fd;
+    int family;
+    int winner;
+    int waiting;
+    int running;
+
+    char *user;
+    char *pass;
+
+    HevTask *task;
+    HevSocks5ClientUpstream *upstream;
+    HevSocks5ClientUpstreamAttempt attempts[2];
+};
+
+HevSocks5ClientUpstream *
+hev_socks5_client_upstream_new (HevSocks5ClientUpstreamPolicy policy)
+{
+    HevSocks5ClientUpstream *self;
+    int res;
+
+    self = hev_malloc0 (sizeof (HevSocks5ClientUpstream));
+    if (!self)
+        return NULL;
+
+    res = hev_socks5_client_upstream_construct (self, policy);
+    if (res < 0) {
+        hev_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p socks5 client upstream new", self);
+
+    return self;
+}
+
+int
+hev_socks5_client_upstream_add (HevSocks5ClientUpstream *self,
+                                const char *addr, int port, int weight)
+{
+    HevSocks5ClientUpstreamServer *servers;
+    HevSocks5ClientUpstreamServer *srv;
+    size_t size;
+
+    LOG_D ("%p socks5 client upstream add [%s]:%d", self, addr, port);
+
+    size = sizeof (HevSocks5ClientUpstreamServer) * (self->nums + 1);
+    servers = hev_realloc (self->servers, size);
+    if (!servers)
+        return -1;
+    self->servers = servers;
+
+    srv = &servers[self->nums];
+    memset (srv, 0, sizeof (HevSocks5ClientUpstreamServer));
+    srv->addr = hev_socks5_strdup (addr);
+    if (!srv->addr)
+        return -1;
+
+    srv->port = port;
+    srv->weight = weight > 0 ? weight : 1;
+    self->nums++;
+
+    return 0;
+}
+
+int
+hev_socks5_client_upstream_set_auth (HevSocks5ClientUpstream *self,
+                                     const char *user, const char *pass)
+{
+    char *u, *p;
+
+    LOG_D ("%p socks5 client upstream set auth", self);
+
+    u = hev_socks5_strdup (user);
+    if (!u)
+        return -1;
+
+    p = hev_socks5_strdup (pass);
+    if (!p) {
+        hev_free (u);
+        return -1;
+    }
+
+    if (self->auth.user)
+        hev_free (self->auth.user);
+    if (self->auth.pass)
+        hev_free (self->auth.pass);
+
+    self->auth.user = u;
+    self->auth.pass = p;
+
+    return 0;
+}
+
+void
+hev_socks5_client_upstream_set_hedge (HevSocks5ClientUpstream *self,
+                                      int percentile)
+{
+    self->hedge = percentile;
+}
+
+void
+hev_socks5_client_upstream_get_hedge_stats (HevSocks5ClientUpstream *self,
+                                            unsigned int *hedged,
+                                            unsigned int *won)
+{
+    *hedged = self->hedged;
+    *won = self->won;
+}
+
+static void
+hev_socks5_client_upstream_succ (HevSocks5ClientUpstream *self,
+                                 HevSocks5ClientUpstreamServer *srv,
+                                 int64_t rtt)
+{
+    self->lats[self->lat_pos] = rtt;
+    self->lat_pos = (self->lat_pos + 1) % HEV_SOCKS5_CLIENT_UPSTREAM_SAMPLES;
+    if (self->lat_nums < HEV_SOCKS5_CLIENT_UPSTREAM_SAMPLES)
+        self->lat_nums++;
+
+    /* rtt is kept scaled by 8 to smooth with 1/8 weight */
+    if (srv->rtt)
+        srv->rtt += rtt - (srv->rtt >> 3);
+    else
+        srv->rtt = rtt << 3;
+
+    srv->fails = 0;
+    srv->down = 0;
+    srv->trial = 0;
+}
+
+static void
+hev_socks5_client_upstream_fail (HevSocks5ClientUpstreamServer *srv, int max)
+{
+    srv->trial = 0;
+    if (++srv->fails < max)
+        return;
+
+    srv->down = 1;
+    srv->retry = hev_socks5_now () + FAIL_TIMEOUT;
+}
+
+static int
+hev_socks5_client_upstream_pick (HevSocks5ClientUpstream *self, int exclude)
+{
+    int64_t now = hev_socks5_now ();
+    int64_t best_cost = 0;
+    int best = -1;
+    int i;
+
+    for (i = 0; i < self->nums; i++) {
+        int id = (self->cursor + i) % self->nums;
+        HevSocks5ClientUpstreamServer *srv = &self->servers[id];
+        int64_t cost;
+
+        if (id == exclude || (srv->down && (now < srv->retry || srv->trial)))
+            continue;
+
+        cost = srv->outstanding + 1;
+        if (self->policy == HEV_SOCKS5_CLIENT_UPSTREAM_POLICY_EWMA)
+            cost *= srv->rtt + 8;
+        cost = (cost << 8) / srv->weight;
+
+        if (best < 0 || cost < best_cost) {
+            best_cost = cost;
+            best = id;
+        }
+    }
+
+    if (best < 0) {
+        /* nothing else is up, try the one that comes back first */
+        for (i = 0; i < self->nums; i++) {
+            if (i == exclude || self->servers[i].trial)
+                continue;
+            if (best < 0 || self->servers[i].retry < self->servers[best].retry)
+                best = i;
+        }
+    }
+
+    /* a server that is down takes one trial connect at a time */
+    if (best >= 0 && self->servers[best].down)
+        self->servers[best].trial = 1;
+
+    self->cursor++;
+
+    return best;
+}
+
+static int
+hev_socks5_client_upstream_dial (HevSocks5ClientUpstream *self,
+                                 HevSocks5Client *client, int id)
+{
+    HevSocks5ClientUpstreamServer *srv = &self->servers[id];
+    struct sockaddr_in6 saddr;
+    int family;
+    int res;
+
+    if (!srv->resolved) {
+        memset (&saddr, 0, sizeof (saddr));
+        family = hev_socks5_get_addr_family (HEV_SOCKS5 (client));
+        res = hev_socks5_name_into_sockaddr6 (srv->addr, srv->port, &saddr,
+                                              &family);
+        /* the set may have grown while this task was waiting */
+        srv = &self->servers[id];
+        if (res < 0) {
+            LOG_I ("%p socks5 client upstream resolve [%s]:%d", self,
+                   srv->addr, srv->port);
+            return -1;
+        }
+
+        srv->saddr = saddr;
+        srv->family = family;
+        srv->resolved = 1;
+    }
+
+    saddr = srv->saddr;
+    res = hev_socks5_client_connect_sockaddr (client, &saddr, srv->family);
+    if (res < 0) {
+        /* the address may have moved, resolve it again next time */
+        self->servers[id].resolved = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+hev_socks5_client_upstream_connect_plain (HevSocks5ClientUpstream *self,
+                                          HevSocks5Client *client,
+                                          int pipeline)
+{
+    HevSocks5ClientUpstreamServer *srv;
+    int64_t start;
+    int id, res;
+
+    id = hev_socks5_client_upstream_pick (self, -1);
+    if (id < 0) {
+        LOG_W ("%p socks5 client upstream empty", self);
+        return -1;
+    }
+
+    srv = &self->servers[id];
+    LOG_D ("%p socks5 client upstream connect [%s]:%d", self, srv->addr,
+           srv->port);
+
+    /* credentials the caller set on its client take precedence */
+    if (!client->auth.user && self->auth.user)
+        hev_socks5_client_set_auth (client, self->auth.user, self->auth.pass);
+
+    srv->outstanding++;
+    start = hev_socks5_now ();
+
+    res = hev_socks5_client_upstream_dial (self, client, id);
+    if (res == 0)
+        res = hev_socks5_client_request (client, pipeline);
+
+    /* the set may have grown while this task was waiting */
+    srv = &self->servers[id];
+    if (res < 0) {
+        /* a refused request still came from a working server */
+        srv->outstanding--;
+        if (res == -1)
+            hev_socks5_client_upstream_fail (srv, MAX_FAILS);
+        return -1;
+    }
+
+    hev_socks5_client_upstream_succ (self, srv, hev_socks5_now () - start);
+
+    return id;
+}
+
+static int
+hev_socks5_client_upstream_cmp (const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static int
+hev_socks5_client_upstream_hedge_delay (HevSocks5ClientUpstream *self)
+{
+    int64_t lats[HEV_SOCKS5_CLIENT_UPSTREAM_SAMPLES];
+    int n = self->lat_nums;
+
+    if (n < HEDGE_MIN_SAMPLES)
+        return HEDGE_DELAY;
+
+    memcpy (lats, self->lats, sizeof (int64_t) * n);
+    qsort (lats, n, sizeof (int64_t), hev_socks5_client_upstream_cmp);
+
+    return lats[(n - 1) * self->hedge / 100] + 1;
+}
+
+static void
+hev_socks5_client_upstream_race_unref (HevSocks5ClientUpstreamRace *race)
+{
+    if (--race->refs)
+        return;
+
+    if (race->fd >= 0)
+        close (race->fd);
+    if (race->user)
+        hev_free (race->user);
+    if (race->pass)
+        hev_free (race->pass);
+
+    hev_object_unref (HEV_OBJECT (race->upstream));
+    hev_free (race);
+}
+
+static void
+hev_socks5_client_upstream_attempt_entry (void *data)
+{
+    HevSocks5ClientUpstreamAttempt *att = data;
+    HevSocks5ClientUpstreamRace *race = att->race;
+    HevSocks5ClientUpstream *self = race->upstream;
+    HevSocks5ClientUpstreamServer *srv = &self->servers[att->id];
+    HevSocks5 *base = HEV_SOCKS5 (att->client);
+    int64_t start;
+    int res;
+
+    LOG_D ("%p socks5 client upstream attempt [%s]:%d", self, srv->addr,
+           srv->port);
+
+    start = hev_socks5_now ();
+    res = hev_socks5_client_upstream_dial (self, att->client, att->id);
+    /* each phase resets the timeout, so a cancel is checked in between */
+    if (res == 0 && !att->cancelled)
+        res = hev_socks5_client_negotiate (att->client);
+    if (att->cancelled)
+        res = -1;
+
+    srv = &self->servers[att->id];
+    if (res == 0) {
+        hev_socks5_client_upstream_succ (self, srv, hev_socks5_now () - start);
+        if (race->winner < 0 && race->waiting) {
+            hev_task_del_fd (hev_task_self (), base->fd);
+            race->fd = base->fd;
+            race->family = hev_socks5_get_addr_family (base);
+            race->winner = att - race->attempts;
+            base->fd = -1;
+        }
+    } else if (!att->cancelled) {
+        hev_socks5_client_upstream_fail (srv, MAX_FAILS);
+    } else {
+        /* the loser was cancelled, that is no failure of its server */
+        srv->trial = 0;
+    }
+
+    att->running = 0;
+    race->running--;
+    if (race->waiting)
+        hev_task_wakeup (race->task);
+
+    hev_object_unref (HEV_OBJECT (att->client));
+    hev_socks5_client_upstream_race_unref (race);
+}
+
+static int
+hev_socks5_client_upstream_attempt (HevSocks5ClientUpstreamRace *race,
+                                    int slot, int id, int family)
+{
+    HevSocks5ClientUpstreamAttempt *att = &race->attempts[slot];
+    HevSocks5ClientUpstreamServer *srv = &race->upstream->servers[id];
+    HevSocks5Client *client;
+    HevTask *task;
+    int res;
+
+    client = hev_malloc0 (sizeof (HevSocks5Client));
+    if (!client)
+        goto exit;
+
+    res = hev_socks5_client_construct (client, HEV_SOCKS5_TYPE_NONE);
+    if (res < 0) {
+        hev_free (client);
+        goto exit;
+    }
+
+    task = hev_task_new (hev_socks5_get_task_stack_size ());
+    if (!task) {
+        hev_object_unref (HEV_OBJECT (client));
+        goto exit;
+    }
+
+    hev_socks5_set_addr_family (HEV_SOCKS5 (client), family);
+    hev_socks5_client_set_auth (client, race->user, race->pass);
+
+    att->id = id;
+    att->running = 1;
+    att->cancelled = 0;
+    att->task = task;
+    att->client = client;
+    att->race = race;
+
+    race->refs++;
+    race->running++;
+    hev_task_run (task, hev_socks5_client_upstream_attempt_entry, att);
+
+    return 0;
+
+exit:
+    srv->trial = 0;
+    return -1;
+}
+
+static int
+hev_socks5_client_upstream_race (HevSocks5ClientUpstream *self,
+                                 HevSocks5ClientUpstreamRace *race,
+                                 int family)
+{
+    int hedge = 1, hedged = 0;
+    int64_t start;
+    int delay;
+    int id, i;
+
+    id = hev_socks5_client_upstream_pick (self, -1);
+    if (id < 0)
+        return -1;
+
+    if (hev_socks5_client_upstream_attempt (race, 0, id, family) < 0)
+        return -1;
+
+    delay = hev_socks5_client_upstream_hedge_delay (self);
+    start = hev_socks5_now ();
+
+    for (;;) {
+        int64_t wait = delay - (hev_socks5_now () - start);
+
+        if (race->winner >= 0 || (!race->running && !hedge))
+            break;
+
+        /* a failed first attempt is retried at once on another server */
+        if (hedge && (!race->running || wait <= 0)) {
+            hedge = 0;
+            hedged = race->running;
+            id = hev_socks5_client_upstream_pick (self, race->attempts[0].id);
+            if (id < 0 ||
+                hev_socks5_client_upstream_attempt (race, 1, id, family) < 0)
+                continue;
+            if (hedged) {
+                LOG_D ("%p socks5 client upstream hedge %d ms", self, delay);
+                self->hedged++;
+            }
+            continue;
+        }
+
+        if (hedge)
+            hev_task_sleep (wait);
+        else
+            hev_task_yield (HEV_TASK_WAITIO);
+    }
+
+    /* cancel whatever is still racing */
+    for (i = 0; i < 2; i++) {
+        HevSocks5ClientUpstreamAttempt *att = &race->attempts[i];
+
+        if (!att->running)
+            continue;
+
+        att->cancelled = 1;
+        hev_socks5_set_timeout (HEV_SOCKS5 (att->client), 0);
+        hev_task_wakeup (att->task);
+    }
+
+    if (race->winner == 1 && hedged)
+        self->won++;
+
+    return race->winner;
+}
+
+static int
+hev_socks5_client_upstream_connect_hedged (HevSocks5ClientUpstream *self,
+                                           HevSocks5Client *client,
+                                           int pipeline)
+{
+    HevSocks5ClientUpstreamRace *race;
+    HevSocks5ClientUpstreamServer *srv;
+    const char *user, *pass;
+    int family;
+    int res;
+    int id;
+
+    race = hev_malloc0 (sizeof (HevSocks5ClientUpstreamRace));
+    if (!race)
+        return -1;
+
+    race->refs = 1;
+    race->fd = -1;
+    race->winner = -1;
+    race->waiting = 1;
+    race->task = hev_task_self ();
+    race->upstream = self;
+    hev_object_ref (HEV_OBJECT (self));
+
+    /* losers may outlive the caller, so they get their own credentials */
+    user = client->auth.user ? client->auth.user : self->auth.user;
+    pass = client->auth.user ? client->auth.pass : self->auth.pass;
+    if (user && pass) {
+        race->user = hev_socks5_strdup (user);
+        race->pass = hev_socks5_strdup (pass);
+        if (!race->user || !race->pass) {
+            hev_socks5_client_upstream_race_unref (race);
+            return -1;
+        }
+    }
+
+    family = hev_socks5_get_addr_family (HEV_SOCKS5 (client));
+    res = hev_socks5_client_upstream_race (self, race, family);
+    race->waiting = 0;
+    if (res < 0) {
+        hev_socks5_client_upstream_race_unref (race);
+        return -1;
+    }
+
+    id = race->attempts[res].id;
+    res = hev_task_add_fd (hev_task_self (), race->fd, POLLIN | POLLOUT);
+    if (res < 0)
+        hev_task_mod_fd (hev_task_self (), race->fd, POLLIN | POLLOUT);
+
+    HEV_SOCKS5 (client)->fd = race->fd;
+    hev_socks5_set_addr_family (HEV_SOCKS5 (client), race->family);
+    client->authed = 1;
+    race->fd = -1;
+    hev_socks5_client_upstream_race_unref (race);
+
+    srv = &self->servers[id];
+    srv->outstanding++;
+
+    res = hev_socks5_client_request (client, pipeline);
+    srv = &self->servers[id];
+    if (res < 0) {
+        srv->outstanding--;
+        if (res == -1)
+            hev_socks5_client_upstream_fail (srv, MAX_FAILS);
+        return -1;
+    }
+
+    return id;
+}
+
+int
+hev_socks5_client_upstream_connect (HevSocks5ClientUpstream *self,
+                                    HevSocks5Client *client, int pipeline)
+{
+    if (self->hedge > 0 && self->hedge < 100)
+        return hev_socks5_client_upstream_connect_hedged (self, client,
+                                                          pipeline);
+
+    return hev_socks5_client_upstream_connect_plain (self, client, pipeline);
+}
+
+void
+hev_socks5_client_upstream_release (HevSocks5ClientUpstream *self, int id)
+{
+    if (id < 0 || id >= self->nums)
+        return;
+
+    self->servers[id].outstanding--;
+}
+
+static int
+hev_socks5_client_upstream_probe_one (HevSocks5ClientUpstream *self, int id)
+{
+    HevSocks5ClientUpstreamServer *srv = &self->servers[id];
+    HevSocks5Client *client;
+    int64_t start;
+    int res;
+
+    client = hev_malloc0 (sizeof (HevSocks5Client));
+    if (!client)
+        return -1;
+
+    res = hev_socks5_client_construct (client, HEV_SOCKS5_TYPE_NONE);
+    if (res < 0) {
+        hev_free (client);
+        return -1;
+    }
+
+    if (self->auth.user)
+        hev_socks5_client_set_auth (client, self->auth.user, self->auth.pass);
+
+    start = hev_socks5_now ();
+    res = hev_socks5_client_upstream_dial (self, client, id);
+    if (res == 0)
+        res = hev_socks5_client_negotiate (client);
+
+    srv = &self->servers[id];
+    if (res == 0) {
+        hev_socks5_client_upstream_succ (self, srv, hev_socks5_now () - start);
+    } else {
+        LOG_I ("%p socks5 client upstream probe [%s]:%d", self, srv->addr,
+               srv->port);
+        hev_socks5_client_upstream_fail (srv, 1);
+    }
+
+    hev_object_unref (HEV_OBJECT (client));
+
+    return res;
+}
+
+static void
+hev_socks5_client_upstream_probe_entry (void *data)
+{
+    HevSocks5ClientUpstream *self = data;
+
+    LOG_D ("%p socks5 client upstream probe", self);
+
+    while (self->probing) {
+        int i;
+
+        for (i = 0; i < self->nums && self->probing; i++)
+            hev_socks5_client_upstream_probe_one (self, i);
+
+        if (self->probing)
+            hev_task_sleep (self->interval);
+    }
+
+    hev_task_unref (self->probe);
+    self->probe = NULL;
+    hev_object_unref (HEV_OBJECT (self));
+}
+
+int
+hev_socks5_client_upstream_start_probe (HevSocks5ClientUpstream *self,
+                                        int interval)
+{
+    HevTask *task;
+
+    LOG_D ("%p socks5 client upstream start probe", self);
+
+    self->interval = interval;
+    if (self->probe) {
+        self->probing = 1;
+        return 0;
+    }
+
+    task = hev_task_new (hev_socks5_get_task_stack_size ());
+    if (!task)
+        return -1;
+
+    self->probing = 1;
+    self->probe = hev_task_ref (task);
+    hev_object_ref (HEV_OBJECT (self));
+    hev_task_run (task, hev_socks5_client_upstream_probe_entry, self);
+
+    return 0;
+}
+
+void
+hev_socks5_client_upstream_stop_probe (HevSocks5ClientUpstream *self)
+{
+    LOG_D ("%p socks5 client upstream stop probe", self);
+
+    self->probing = 0;
+    if (self->probe)
+        hev_task_wakeup (self->probe);
+}
+
+int
+hev_socks5_client_upstream_construct (HevSocks5ClientUpstream *self,
+                                      HevSocks5ClientUpstreamPolicy policy)
+{
+    int res;
+
+    res = hev_object_construct (&self->base);
+    if (res < 0)
+        return res;
+
+    LOG_D ("%p socks5 client upstream construct", self);
+
+    HEV_OBJECT (self)->klass = HEV_SOCKS5_CLIENT_UPSTREAM_TYPE;
+
+    self->policy = policy;
+
+    return 0;
+}
+
+static void
+hev_socks5_client_upstream_destruct (HevObject *base)
+{
+    HevSocks5ClientUpstream *self = HEV_SOCKS5_CLIENT_UPSTREAM (base);
+    int i;
+
+    LOG_D ("%p socks5 client upstream destruct", self);
+
+    for (i = 0; i < self->nums; i++)
+        hev_free (self->servers[i].addr);
+
+    if (self->auth.user)
+        hev_free (self->auth.user);
+    if (self->auth.pass)
+        hev_free (self->auth.pass);
+
+    if (self->servers)
+        hev_free (self->servers);
+
+    HEV_OBJECT_TYPE->destruct (base);
+    hev_free (base);
+}
+
+HevObjectClass *
+hev_socks5_client_upstream_class (void)
+{
+    static HevSocks5ClientUpstreamClass klass;
+    HevSocks5ClientUpstreamClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        memcpy (kptr, HEV_OBJECT_TYPE, sizeof (HevObjectClass));
+
+        okptr->name = "HevSocks5ClientUpstream";
+        okptr->destruct = hev_socks5_client_upstream_destruct;
+    }
+
+    return okptr;
+}
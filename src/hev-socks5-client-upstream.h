@@ -0,0 +1,151 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-client-upstream.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Client Upstream
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_CLIENT_UPSTREAM_H__
+#define __HEV_SOCKS5_CLIENT_UPSTREAM_H__
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include <hev-task.h>
+#include <hev-object.h>
+
+#include "hev-socks5-client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_SOCKS5_CLIENT_UPSTREAM(p) ((HevSocks5ClientUpstream *)p)
+#define HEV_SOCKS5_CLIENT_UPSTREAM_CLASS(p) ((HevSocks5ClientUpstreamClass *)p)
+#define HEV_SOCKS5_CLIENT_UPSTREAM_TYPE (hev_socks5_client_upstream_class ())
+
+#define HEV_SOCKS5_CLIENT_UPSTREAM_SAMPLES (64)
+
+typedef struct _HevSocks5ClientUpstream HevSocks5ClientUpstream;
+typedef struct _HevSocks5ClientUpstreamServer HevSocks5ClientUpstreamServer;
+typedef struct _HevSocks5ClientUpstreamClass HevSocks5ClientUpstreamClass;
+typedef enum _HevSocks5ClientUpstreamPolicy HevSocks5ClientUpstreamPolicy;
+
+enum _HevSocks5ClientUpstreamPolicy
+{
+    HEV_SOCKS5_CLIENT_UPSTREAM_POLICY_EWMA,
+    HEV_SOCKS5_CLIENT_UPSTREAM_POLICY_LEAST_CONN,
+};
+
+struct _HevSocks5ClientUpstreamServer
+{
+    char *addr;
+    int port;
+    int weight;
+    int outstanding;
+    int fails;
+    int down;
+    int trial;
+    int family;
+    int resolved;
+    int64_t retry;
+    int64_t rtt;
+
+    struct sockaddr_in6 saddr;
+};
+
+/*
+ * A weighted set of socks5 servers. Each connect picks the server with the
+ * lowest cost: EWMA handshake latency times outstanding sessions, or just
+ * outstanding sessions, divided by weight. Failed connects and handshakes
+ * take a server out for a while, after which a single trial connect must
+ * succeed before it takes sessions again; optional probes keep latency
+ * fresh and bring dead servers back. Server names are resolved once and
+ * again only after a failed connect. An upstream set is owned by the task
+ * system of the thread that created it.
+ */
+struct _HevSocks5ClientUpstream
+{
+    HevObject base;
+
+    int nums;
+    int cursor;
+    int policy;
+    int interval;
+    int probing;
+    int hedge;
+
+    unsigned int hedged;
+    unsigned int won;
+
+    int lat_pos;
+    int lat_nums;
+    int64_t lats[HEV_SOCKS5_CLIENT_UPSTREAM_SAMPLES];
+
+    HevTask *probe;
+
+    struct
+    {
+        char *user;
+        char *pass;
+    } auth;
+
+    HevSocks5ClientUpstreamServer *servers;
+};
+
+struct _HevSocks5ClientUpstreamClass
+{
+    HevObjectClass base;
+};
+
+HevObjectClass *hev_socks5_client_upstream_class (void);
+
+int hev_socks5_client_upstream_construct (HevSocks5ClientUpstream *self,
+                                          HevSocks5ClientUpstreamPolicy policy);
+
+HevSocks5ClientUpstream *
+hev_socks5_client_upstream_new (HevSocks5ClientUpstreamPolicy policy);
+
+int hev_socks5_client_upstream_add (HevSocks5ClientUpstream *self,
+                                    const char *addr, int port, int weight);
+
+int hev_socks5_client_upstream_set_auth (HevSocks5ClientUpstream *self,
+                                         const char *user, const char *pass);
+
+/*
+ * Enables hedged connects when percentile is in 1..99: if connect plus
+ * method negotiation has not finished after that percentile of recent
+ * latencies, a second attempt races against another server and the first
+ * to finish carries the request. 0 disables hedging.
+ */
+void hev_socks5_client_upstream_set_hedge (HevSocks5ClientUpstream *self,
+                                           int percentile);
+void hev_socks5_client_upstream_get_hedge_stats (HevSocks5ClientUpstream *self,
+                                                 unsigned int *hedged,
+                                                 unsigned int *won);
+
+/*
+ * Probes every server with a connect and method negotiation each interval
+ * milliseconds. The probe task holds a reference until it is stopped.
+ */
+int hev_socks5_client_upstream_start_probe (HevSocks5ClientUpstream *self,
+                                            int interval);
+void hev_socks5_client_upstream_stop_probe (HevSocks5ClientUpstream *self);
+
+/*
+ * Connects the client to the best server and runs the handshake. Returns a
+ * server id that must be passed to release when the session ends, or -1.
+ */
+int hev_socks5_client_upstream_connect (HevSocks5ClientUpstream *self,
+                                        HevSocks5Client *client,
+                                        int pipeline);
+void hev_socks5_client_upstream_release (HevSocks5ClientUpstream *self,
+                                         int id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_SOCKS5_CLIENT_UPSTREAM_H__ */
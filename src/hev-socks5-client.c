@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-socks5-client.c
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2021 - 2025 hev
+ Copyright   : Copyright (c) 2021 - 2026 hev
  Description : Socks5 Client
  ============================================================================
  */
@@ -19,6 +19,7 @@
 #include "hev-socks5-logger-priv.h"
 
 #include "hev-socks5-client.h"
+#include "hev-socks5-client-priv.h"
 
 #ifndef MSG_MORE
 #define MSG_MORE 0
@@ -53,15 +54,9 @@ hev_socks5_client_write_auth_methods (HevSocks5Client *self)
 }
 
 static int
-hev_socks5_client_write_auth_creds (HevSocks5Client *self)
+hev_socks5_client_fill_auth_creds (HevSocks5Client *self, unsigned char *ub,
+                                   struct iovec *iov)
 {
-    struct msghdr mh = { 0 };
-    struct iovec iov[4];
-    unsigned char ub[3];
-    int res;
-
-    LOG_D ("%p socks5 client write auth creds", self);
-
     if (!self->auth.user || !self->auth.pass)
         return 0;
 
@@ -77,8 +72,24 @@ hev_socks5_client_write_auth_creds (HevSocks5Client *self)
     iov[3].iov_base = (void *)self->auth.pass;
     iov[3].iov_len = ub[2];
 
+    return 4;
+}
+
+static int
+hev_socks5_client_write_auth_creds (HevSocks5Client *self)
+{
+    struct msghdr mh = { 0 };
+    struct iovec iov[4];
+    unsigned char ub[3];
+    int res;
+
+    LOG_D ("%p socks5 client write auth creds", self);
+
     mh.msg_iov = iov;
-    mh.msg_iovlen = 4;
+    mh.msg_iovlen = hev_socks5_client_fill_auth_creds (self, ub, iov);
+    if (!mh.msg_iovlen)
+        return 0;
+
     res = hev_task_io_socket_sendmsg (HEV_SOCKS5 (self)->fd, &mh,
                                       MSG_WAITALL | MSG_MORE, task_io_yielder,
                                       self);
@@ -91,40 +102,37 @@ hev_socks5_client_write_auth_creds (HevSocks5Client *self)
 }
 
 static int
-hev_socks5_client_write_request (HevSocks5Client *self)
+hev_socks5_client_fill_request (HevSocks5Client *self, HevSocks5ReqRes *req,
+                                struct iovec *iov)
 {
     HevSocks5ClientClass *klass;
-    struct msghdr mh = { 0 };
-    struct iovec iov[2];
     HevSocks5Addr *addr;
-    HevSocks5ReqRes req;
     int addrlen;
-    int ret;
 
-    LOG_D ("%p socks5 client write request", self);
-
-    req.ver = HEV_SOCKS5_VERSION_5;
-    req.rsv = 0;
+    req->ver = HEV_SOCKS5_VERSION_5;
+    req->rsv = 0;
 
     switch (HEV_SOCKS5 (self)->type) {
     case HEV_SOCKS5_TYPE_TCP:
-        req.cmd = HEV_SOCKS5_REQ_CMD_CONNECT;
+        req->cmd = HEV_SOCKS5_REQ_CMD_CONNECT;
         break;
     case HEV_SOCKS5_TYPE_UDP_IN_TCP:
-        req.cmd = HEV_SOCKS5_REQ_CMD_FWD_UDP;
+        req->cmd = HEV_SOCKS5_REQ_CMD_FWD_UDP;
         break;
     case HEV_SOCKS5_TYPE_UDP_IN_UDP:
-        req.cmd = HEV_SOCKS5_REQ_CMD_UDP_ASC;
+        req->cmd = HEV_SOCKS5_REQ_CMD_UDP_ASC;
         break;
     default:
         return -1;
     }
 
-    iov[0].iov_base = &req;
+    iov[0].iov_base = req;
     iov[0].iov_len = 3;
 
     klass = HEV_OBJECT_GET_CLASS (self);
     addr = klass->get_upstream_addr (self);
+    if (!addr)
+        return -1;
 
     switch (addr->atype) {
     case HEV_SOCKS5_ADDR_TYPE_IPV4:
@@ -138,23 +146,49 @@ hev_socks5_client_write_request (HevSocks5Client *self)
         break;
     default:
         LOG_I ("%p socks5 client req.atype %u", self, addr->atype);
+        hev_free (addr);
         return -1;
     }
 
     iov[1].iov_base = addr;
     iov[1].iov_len = addrlen;
 
+    if (!self->early.len)
+        return 2;
+
+    /* first payload rides in the same flight as the request */
+    iov[2].iov_base = (void *)self->early.data;
+    iov[2].iov_len = self->early.len;
+    self->early.data = NULL;
+    self->early.len = 0;
+
+    return 3;
+}
+
+static int
+hev_socks5_client_write_request (HevSocks5Client *self)
+{
+    struct msghdr mh = { 0 };
+    struct iovec iov[3];
+    HevSocks5ReqRes req;
+    int ret;
+
+    LOG_D ("%p socks5 client write request", self);
+
+    ret = hev_socks5_client_fill_request (self, &req, iov);
+    if (ret < 0)
+        return -1;
+
     mh.msg_iov = iov;
-    mh.msg_iovlen = 2;
+    mh.msg_iovlen = ret;
     ret = hev_task_io_socket_sendmsg (HEV_SOCKS5 (self)->fd, &mh, MSG_WAITALL,
                                       task_io_yielder, self);
+    hev_free (iov[1].iov_base);
     if (ret <= 0) {
         LOG_I ("%p socks5 client write request", self);
         return -1;
     }
 
-    hev_free (addr);
-
     return 0;
 }
 
@@ -235,7 +269,7 @@ hev_socks5_client_read_response (HevSocks5Client *self)
 
     if (res.rep != HEV_SOCKS5_RES_REP_SUCC) {
         LOG_I ("%p socks5 client res.rep %u", self, res.rep);
-        return -1;
+        return -2;
     }
 
     switch (res.addr.atype) {
@@ -267,67 +301,77 @@ hev_socks5_client_read_response (HevSocks5Client *self)
     return 0;
 }
 
+int
+hev_socks5_client_connect_sockaddr (HevSocks5Client *self,
+                                    struct sockaddr_in6 *saddr, int family)
+{
+    const HevSocks5SocketProfile *profile;
+    HevSocks5FastOpen tfo = { 0 };
+    int timeout;
+    int idx;
+    int fd;
+
+    timeout = hev_socks5_get_connect_timeout ();
+    hev_socks5_set_timeout (HEV_SOCKS5 (self), timeout);
+
+    fd = hev_socks5_connect_race (HEV_SOCKS5 (self), saddr, 1, &idx, &tfo);
+    if (fd < 0) {
+        LOG_I ("%p socks5 client connect", self);
+        return -1;
+    }
+
+    HEV_SOCKS5 (self)->fd = fd;
+    hev_socks5_set_addr_family (HEV_SOCKS5 (self), family);
+    profile = hev_socks5_get_socket_profile (HEV_SOCKS5 (self)->type,
+                                             ntohs (saddr->sin6_port));
+    hev_socks5_socket_profile_apply (fd, profile);
+    LOG_D ("%p socks5 client connect server fd %d", self, fd);
+
+    return 0;
+}
+
 int
 hev_socks5_client_connect (HevSocks5Client *self, const char *addr, int port)
 {
-    HevSocks5Class *klass;
+    const HevSocks5SocketProfile *profile;
+    HevSocks5FastOpen tfo = { 0 };
     struct sockaddr_in6 saddr;
-    struct sockaddr *sap;
-    int addr_family;
     int timeout;
-    int fd, res;
+    int fd;
 
     LOG_D ("%p socks5 client connect [%s]:%d", self, addr, port);
 
     timeout = hev_socks5_get_connect_timeout ();
     hev_socks5_set_timeout (HEV_SOCKS5 (self), timeout);
 
-    memset (&saddr, 0, sizeof (saddr));
-    addr_family = hev_socks5_get_addr_family (HEV_SOCKS5 (self));
-    res = hev_socks5_name_into_sockaddr6 (addr, port, &saddr, &addr_family);
-    if (res < 0) {
+    fd = hev_socks5_connect_name (HEV_SOCKS5 (self), addr, port, &saddr,
+                                  &tfo);
+    if (fd == -2) {
         LOG_I ("%p socks5 client resolve [%s]:%d", self, addr, port);
         return -1;
-    }
-
-    fd = hev_socks5_socket (SOCK_STREAM);
-    if (fd < 0) {
-        LOG_E ("%p socks5 client socket", self);
-        return -1;
-    }
-
-    sap = (struct sockaddr *)&saddr;
-    klass = HEV_OBJECT_GET_CLASS (self);
-    res = klass->binder (HEV_SOCKS5 (self), fd, sap);
-    if (res < 0) {
-        LOG_W ("%p socks5 client bind", self);
-        hev_task_del_fd (hev_task_self (), fd);
-        close (fd);
-        return -1;
-    }
-
-    res = hev_task_io_socket_connect (fd, sap, sizeof (saddr), task_io_yielder,
-                                      self);
-    if (res < 0) {
+    } else if (fd < 0) {
         LOG_I ("%p socks5 client connect", self);
-        hev_task_del_fd (hev_task_self (), fd);
-        close (fd);
         return -1;
     }
 
     HEV_SOCKS5 (self)->fd = fd;
-    hev_socks5_set_addr_family (HEV_SOCKS5 (self), addr_family);
+    profile = hev_socks5_get_socket_profile (HEV_SOCKS5 (self)->type, port);
+    hev_socks5_socket_profile_apply (fd, profile);
     LOG_D ("%p socks5 client connect server fd %d", self, fd);
 
     return 0;
 }
 
-static int
-hev_socks5_client_handshake_standard (HevSocks5Client *self)
+int
+hev_socks5_client_negotiate (HevSocks5Client *self)
 {
+    int timeout;
     int res;
 
-    LOG_D ("%p socks5 client handshake standard", self);
+    LOG_D ("%p socks5 client negotiate", self);
+
+    timeout = hev_socks5_get_tcp_timeout ();
+    hev_socks5_set_timeout (HEV_SOCKS5 (self), timeout);
 
     res = hev_socks5_client_write_auth_methods (self);
     if (res < 0)
@@ -350,58 +394,212 @@ hev_socks5_client_handshake_standard (HevSocks5Client *self)
         return -1;
     }
 
+    hev_socks5_tcp_fastopen_account (HEV_SOCKS5 (self)->fd);
+    self->authed = 1;
+
+    return 0;
+}
+
+static int
+hev_socks5_client_handshake_authed (HevSocks5Client *self)
+{
+    int res;
+
+    LOG_D ("%p socks5 client handshake authed", self);
+
     res = hev_socks5_client_write_request (self);
     if (res < 0)
         return -1;
 
     res = hev_socks5_client_read_response (self);
     if (res < 0)
-        return -1;
+        return res;
 
     return 0;
 }
 
 static int
-hev_socks5_client_handshake_pipeline (HevSocks5Client *self)
+hev_socks5_client_handshake_standard (HevSocks5Client *self)
 {
     int res;
 
-    LOG_D ("%p socks5 client handshake pipeline", self);
+    LOG_D ("%p socks5 client handshake standard", self);
 
-    res = hev_socks5_client_write_auth_methods (self);
+    res = hev_socks5_client_negotiate (self);
     if (res < 0)
         return -1;
 
-    res = hev_socks5_client_write_auth_creds (self);
+    res = hev_socks5_client_write_request (self);
     if (res < 0)
         return -1;
 
-    res = hev_socks5_client_write_request (self);
+    res = hev_socks5_client_read_response (self);
     if (res < 0)
-        return -1;
+        return res;
 
-    res = hev_socks5_client_read_auth_method (self);
+    return 0;
+}
+
+static int
+hev_socks5_client_write_pipeline (HevSocks5Client *self)
+{
+    struct msghdr mh = { 0 };
+    struct iovec iov[8];
+    unsigned char ub[3];
+    HevSocks5ReqRes req;
+    HevSocks5Auth auth;
+    int res, n;
+
+    LOG_D ("%p socks5 client write pipeline", self);
+
+    n = hev_socks5_client_fill_auth_creds (self, ub, &iov[1]);
+
+    auth.ver = HEV_SOCKS5_VERSION_5;
+    auth.method_len = 1;
+    auth.methods[0] =
+        n ? HEV_SOCKS5_AUTH_METHOD_USER : HEV_SOCKS5_AUTH_METHOD_NONE;
+    iov[0].iov_base = &auth;
+    iov[0].iov_len = 3;
+
+    res = hev_socks5_client_fill_request (self, &req, &iov[1 + n]);
     if (res < 0)
         return -1;
 
-    if (res == HEV_SOCKS5_AUTH_METHOD_USER) {
-        res = hev_socks5_client_read_auth_creds (self);
-        if (res < 0)
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 1 + n + res;
+    res = hev_task_io_socket_sendmsg (HEV_SOCKS5 (self)->fd, &mh, MSG_WAITALL,
+                                      task_io_yielder, self);
+    hev_free (iov[2 + n].iov_base);
+    if (res <= 0) {
+        LOG_I ("%p socks5 client write pipeline", self);
+        return -1;
+    }
+
+    return n;
+}
+
+static int
+hev_socks5_client_read_pipeline (HevSocks5Client *self, int creds)
+{
+    HevSocks5ClientClass *klass;
+    unsigned char buf[4 + sizeof (HevSocks5ReqRes)];
+    HevSocks5ReqRes *res;
+    int len, off;
+    int method;
+    int ret;
+
+    LOG_D ("%p socks5 client read pipeline", self);
+
+    /*
+     * Method reply, auth reply and the shortest (IPv4) response are read at
+     * once; only an IPv6 bound address needs one more read. Nothing past the
+     * response is consumed, so early data from the remote stays queued.
+     */
+    len = creds ? 14 : 12;
+    ret = hev_task_io_socket_recv (HEV_SOCKS5 (self)->fd, buf, len,
+                                   MSG_WAITALL, task_io_yielder, self);
+    if (ret < 2) {
+        LOG_I ("%p socks5 client read auth", self);
+        return -1;
+    }
+
+    if (buf[0] != HEV_SOCKS5_VERSION_5) {
+        LOG_I ("%p socks5 client auth.ver %u", self, buf[0]);
+        return -1;
+    }
+
+    method = creds ? HEV_SOCKS5_AUTH_METHOD_USER : HEV_SOCKS5_AUTH_METHOD_NONE;
+    if (buf[1] != method) {
+        LOG_I ("%p socks5 client auth method %d", self, buf[1]);
+        return -1;
+    }
+
+    off = 2;
+    if (creds) {
+        if (ret < 4) {
+            LOG_I ("%p socks5 client read auth creds", self);
             return -1;
-    } else if (res != HEV_SOCKS5_AUTH_METHOD_NONE) {
-        LOG_I ("%p socks5 client auth method %d", self, res);
+        }
+
+        if (buf[2] != HEV_SOCKS5_AUTH_VERSION_1) {
+            LOG_I ("%p socks5 client auth.res.ver %u", self, buf[2]);
+            return -1;
+        }
+
+        if (buf[3] != HEV_SOCKS5_RES_REP_SUCC) {
+            LOG_I ("%p socks5 client auth.res.rep %u", self, buf[3]);
+            return -1;
+        }
+
+        LOG_D ("%p socks5 client auth done", self);
+        off = 4;
+    }
+
+    if (ret != len) {
+        LOG_I ("%p socks5 client read response", self);
         return -1;
     }
 
-    res = hev_socks5_client_read_response (self);
+    res = (HevSocks5ReqRes *)&buf[off];
+    if (res->ver != HEV_SOCKS5_VERSION_5) {
+        LOG_I ("%p socks5 client res.ver %u", self, res->ver);
+        return -1;
+    }
+
+    if (res->rep != HEV_SOCKS5_RES_REP_SUCC) {
+        LOG_I ("%p socks5 client res.rep %u", self, res->rep);
+        return -2;
+    }
+
+    switch (res->addr.atype) {
+    case HEV_SOCKS5_ADDR_TYPE_IPV4:
+        break;
+    case HEV_SOCKS5_ADDR_TYPE_IPV6:
+        ret = hev_task_io_socket_recv (HEV_SOCKS5 (self)->fd, &buf[len], 12,
+                                       MSG_WAITALL, task_io_yielder, self);
+        if (ret != 12) {
+            LOG_I ("%p socks5 client read addr", self);
+            return -1;
+        }
+        break;
+    default:
+        LOG_I ("%p socks5 client res.atype %u", self, res->addr.atype);
+        return -1;
+    }
+
+    klass = HEV_OBJECT_GET_CLASS (self);
+    ret = klass->set_upstream_addr (self, &res->addr);
+    if (ret < 0) {
+        LOG_W ("%p socks5 client set upstream addr", self);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+hev_socks5_client_handshake_pipeline (HevSocks5Client *self)
+{
+    int res;
+
+    LOG_D ("%p socks5 client handshake pipeline", self);
+
+    res = hev_socks5_client_write_pipeline (self);
     if (res < 0)
         return -1;
 
+    res = hev_socks5_client_read_pipeline (self, res);
+    if (res < 0)
+        return res;
+
+    hev_socks5_tcp_fastopen_account (HEV_SOCKS5 (self)->fd);
+    self->authed = 1;
+
     return 0;
 }
 
 int
-hev_socks5_client_handshake (HevSocks5Client *self, int pipeline)
+hev_socks5_client_request (HevSocks5Client *self, int pipeline)
 {
     int timeout;
     int res;
@@ -409,7 +607,9 @@ hev_socks5_client_handshake (HevSocks5Client *self, int pipeline)
     timeout = hev_socks5_get_tcp_timeout ();
     hev_socks5_set_timeout (HEV_SOCKS5 (self), timeout);
 
-    if (pipeline)
+    if (self->authed)
+        res = hev_socks5_client_handshake_authed (self);
+    else if (pipeline)
         res = hev_socks5_client_handshake_pipeline (self);
     else
         res = hev_socks5_client_handshake_standard (self);
@@ -427,6 +627,18 @@ hev_socks5_client_handshake (HevSocks5Client *self, int pipeline)
     return res;
 }
 
+int
+hev_socks5_client_handshake (HevSocks5Client *self, int pipeline)
+{
+    int res;
+
+    res = hev_socks5_client_request (self, pipeline);
+    if (res < 0)
+        return -1;
+
+    return 0;
+}
+
 void
 hev_socks5_client_set_auth (HevSocks5Client *self, const char *user,
                             const char *pass)
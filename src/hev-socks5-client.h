@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-socks5-client.h
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2021 - 2024 hev
+ Copyright   : Copyright (c) 2021 - 2026 hev
  Description : Socks5 Client
  ============================================================================
  */
@@ -33,6 +33,14 @@ struct _HevSocks5Client
         const char *user;
         const char *pass;
     } auth;
+
+    struct
+    {
+        const void *data;
+        size_t len;
+    } early;
+
+    unsigned int authed : 1;
 };
 
 struct _HevSocks5ClientClass
@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-socks5-misc-priv.h
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2021 - 2025 hev
+ Copyright   : Copyright (c) 2021 - 2026 hev
  Description : Socks5 Misc Private
  ============================================================================
  */
@@ -15,6 +15,7 @@
 #include <hev-task.h>
 #include <hev-task-io.h>
 
+#include "hev-socks5.h"
 #include "hev-socks5-misc.h"
 #include "hev-socks5-proto.h"
 
@@ -22,17 +23,103 @@
 extern "C" {
 #endif
 
+#define HEV_SOCKS5_CONNECT_ADDRS (8)
+#define HEV_SOCKS5_DNS_NAMESERVERS (3)
+#define HEV_SOCKS5_EGRESS_SOURCES (16)
+#define HEV_SOCKS5_SOCKET_PROFILE_PORTS (16)
+
+typedef struct _HevSocks5FastOpen HevSocks5FastOpen;
+typedef enum _HevSocks5HandshakePhase HevSocks5HandshakePhase;
+
+enum _HevSocks5HandshakePhase
+{
+    HEV_SOCKS5_HANDSHAKE_GREETING,
+    HEV_SOCKS5_HANDSHAKE_AUTH,
+    HEV_SOCKS5_HANDSHAKE_REQUEST,
+};
+
+struct _HevSocks5FastOpen
+{
+    const void *data;
+    size_t len;
+    ssize_t sent;
+};
+
 int hev_socks5_socket (int type);
 
+int hev_socks5_name_into_sockaddr6v (const char *name, int port,
+                                     struct sockaddr_in6 *saddrs, int nums,
+                                     int *family);
+int hev_socks5_addr_into_sockaddr6v (const HevSocks5Addr *addr,
+                                     struct sockaddr_in6 *saddrs, int nums,
+                                     int *family);
+
+/*
+ * Connect helpers race the given or resolved addresses Happy Eyeballs style
+ * under the session timeout. They return the connected fd, -1 when every
+ * attempt failed or -2 when the address could not be resolved. A non-NULL
+ * tfo uses TCP Fast Open when enabled and there is a single address: its
+ * data goes out with the SYN and sent tells how much was taken, or with no
+ * data the SYN waits for the first write. hev_socks5_connect_resolved
+ * takes the timeout separately, usually &self->timeout, so a helper task
+ * can race on its own budget; setting it to 0 aborts the race.
+ */
+int hev_socks5_connect_race (HevSocks5 *self, struct sockaddr_in6 *saddrs,
+                             int nums, int *index, HevSocks5FastOpen *tfo);
+int hev_socks5_connect_name (HevSocks5 *self, const char *name, int port,
+                             struct sockaddr_in6 *saddr,
+                             HevSocks5FastOpen *tfo);
+int hev_socks5_connect_resolved (HevSocks5 *self, const int *timeout,
+                                 const HevSocks5Addr *addr,
+                                 struct sockaddr_in6 *saddrs, int nums,
+                                 struct sockaddr_in6 *saddr,
+                                 HevSocks5FastOpen *tfo);
+
+/* binds to an egress source unless the socket is bound already */
+int hev_socks5_egress_bind (int fd, const struct sockaddr_in6 *dest);
+
+const HevSocks5SocketProfile *hev_socks5_get_socket_profile (HevSocks5Type type,
+                                                             int port);
+void hev_socks5_socket_profile_apply (int fd,
+                                      const HevSocks5SocketProfile *profile);
+
+/* counts whether the peer took the SYN data of a fast open socket */
+void hev_socks5_tcp_fastopen_account (int fd);
+
+void hev_socks5_handshake_account (HevSocks5HandshakePhase phase);
+
+int64_t hev_socks5_now (void);
+
+/* sleeps until woken or timeout, returning 0 once the timeout expires */
+int hev_socks5_task_wait (int timeout);
+
+char *hev_socks5_strdup (const char *str);
+
+int hev_socks5_addr_get_port (const HevSocks5Addr *addr);
+
 const char *hev_socks5_addr_into_str (const HevSocks5Addr *addr, char *buf,
                                       int len);
 
 int hev_socks5_get_connect_timeout (void);
+int hev_socks5_get_connect_optimistic (void);
+int hev_socks5_get_connect_speculative (void);
 int hev_socks5_get_tcp_timeout (void);
 int hev_socks5_get_udp_timeout (void);
+int hev_socks5_get_handshake_timeout (void);
+int hev_socks5_get_handshake_min_rate (void);
+
+int hev_socks5_get_tcp_duplex_threshold (void);
+int hev_socks5_get_tcp_duplex_threaded (void);
 
 int hev_socks5_get_task_stack_size (void);
 int hev_socks5_get_udp_copy_buffer_nums (void);
+int hev_socks5_get_udp_shard_nums (void);
+int hev_socks5_get_udp_shard_rate (void);
+int hev_socks5_get_worker_nums (void);
+
+int hev_socks5_get_dns_nameservers (struct sockaddr_in6 *servers);
+int hev_socks5_get_dns_timeout (void);
+int hev_socks5_get_dns_attempts (void);
 
 #ifdef __cplusplus
 }
@@ -2,15 +2,23 @@
  ============================================================================
  Name        : hev-socks5-misc.c
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2021 - 2025 hev
+ Copyright   : Copyright (c) 2021 - 2026 hev
  Description : Socks5 Misc
  ============================================================================
  */
 
+#define _GNU_SOURCE
+#include <poll.h>
+#include <time.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 
 #include <hev-task.h>
 #include <hev-task-io.h>
@@ -23,14 +31,397 @@
 
 #include "hev-socks5-misc.h"
 #include "hev-socks5-misc-priv.h"
+#include "hev-socks5-resolver-priv.h"
+
+#define DNS_CACHE_SHARDS (16)
+#define DNS_CACHE_WAYS (4)
+#define TIMER_WHEEL_SLOTS (512)
+
+typedef struct _HevSocks5DNSWaiter HevSocks5DNSWaiter;
+typedef struct _HevSocks5DNSEntry HevSocks5DNSEntry;
+typedef struct _HevSocks5DNSShard HevSocks5DNSShard;
+typedef struct _HevSocks5DNSCache HevSocks5DNSCache;
+typedef struct _HevSocks5TimerNode HevSocks5TimerNode;
+typedef struct _HevSocks5TimerWheel HevSocks5TimerWheel;
+
+struct _HevSocks5DNSWaiter
+{
+    HevSocks5DNSWaiter *next;
+
+    int done;
+    int fds[2];
+};
+
+struct _HevSocks5DNSEntry
+{
+    unsigned int hash;
+    int family;
+    int nums; /* -1: in flight, 0: negative */
+    int64_t expire;
+
+    HevSocks5DNSWaiter *waiters;
+
+    char name[256];
+    struct in6_addr addrs[HEV_SOCKS5_CONNECT_ADDRS];
+};
+
+struct _HevSocks5DNSShard
+{
+    pthread_mutex_t lock;
+    HevSocks5DNSEntry *entries;
+};
+
+struct _HevSocks5DNSCache
+{
+    int sets;
+    HevSocks5DNSShard shards[DNS_CACHE_SHARDS];
+};
 
 static int connect_timeout = 10000;
+static int connect_optimistic;
+static int connect_speculative;
 static int tcp_timeout = 300000;
 static int udp_timeout = 60000;
 
+static int tcp_duplex_threshold;
+static int tcp_duplex_threaded;
+static int handshake_timeout;
+static int handshake_min_rate;
+static unsigned int handshake_timeouts[3];
+static int tcp_fastopen;
+static unsigned int tcp_fastopen_syn_data;
+static unsigned int tcp_fastopen_fallbacks;
+
 static int task_stack_size = 8192;
 static int udp_recv_buffer_size = 512 * 1024;
 static int udp_copy_buffer_nums = 10;
+static int udp_shard_nums;
+static int udp_shard_rate = 8192;
+static int worker_nums;
+
+static int dns_cache_min_ttl = 30000;
+static int dns_cache_max_ttl = 300000;
+static int dns_cache_neg_ttl = 5000;
+static unsigned int dns_cache_hits;
+static unsigned int dns_cache_misses;
+static unsigned int dns_cache_joins;
+static HevSocks5DNSCache *dns_cache;
+
+static int dns_native;
+static int dns_timeout = 2000;
+static int dns_attempts = 2;
+static int dns_server_nums;
+static int dns_conf_server_nums;
+static struct sockaddr_in6 dns_servers[HEV_SOCKS5_DNS_NAMESERVERS];
+static struct sockaddr_in6 dns_conf_servers[HEV_SOCKS5_DNS_NAMESERVERS];
+static pthread_once_t dns_conf_once = PTHREAD_ONCE_INIT;
+
+struct _HevSocks5TimerNode
+{
+    HevSocks5TimerNode *prev;
+    HevSocks5TimerNode *next;
+    HevSocks5TimerNode *hnext;
+    HevSocks5TimerNode **slot;
+
+    int timeout;
+    int expired;
+    int64_t expire;
+    int64_t active;
+    HevTask *task;
+    HevTask *waiter;
+};
+
+struct _HevSocks5TimerWheel
+{
+    int tick;
+    int nums;
+    int64_t now;
+    int64_t pos;
+
+    unsigned int hsize;
+    unsigned int hnums;
+    HevSocks5TimerNode **hash;
+
+    HevTask *ticker;
+    HevSocks5TimerNode *slots[TIMER_WHEEL_SLOTS];
+};
+
+static int timer_tick;
+static __thread HevSocks5TimerWheel timer_wheel;
+
+static int egress_policy;
+static int egress_source_nums;
+static unsigned int egress_cursor;
+static unsigned int egress_used[HEV_SOCKS5_EGRESS_SOURCES];
+static struct sockaddr_in6 egress_sources[HEV_SOCKS5_EGRESS_SOURCES];
+
+static int tcp_user_timeout;
+static int tcp_keepidle;
+static int tcp_keepintvl;
+static int tcp_keepcnt;
+
+static const HevSocks5SocketProfile *type_profiles[4];
+static struct
+{
+    int port;
+    const HevSocks5SocketProfile *profile;
+} port_profiles[HEV_SOCKS5_SOCKET_PROFILE_PORTS];
+
+/* the family that last won a connect race, keyed by name hash */
+static unsigned int family_cache[1024];
+
+static void
+hev_socks5_timer_wheel_link (HevSocks5TimerWheel *wheel,
+                             HevSocks5TimerNode *node)
+{
+    int64_t pos;
+
+    /*
+     * Round up: a slot fires once the coarse clock reaches its start, which
+     * must not be before the deadline. Never behind the ticker either, or
+     * it would wait a whole round.
+     */
+    pos = (node->expire + wheel->tick - 1) / wheel->tick;
+    if (pos < wheel->pos)
+        pos = wheel->pos;
+
+    node->slot = &wheel->slots[pos % TIMER_WHEEL_SLOTS];
+    node->prev = NULL;
+    node->next = *node->slot;
+    if (node->next)
+        node->next->prev = node;
+    *node->slot = node;
+    wheel->nums++;
+}
+
+static void
+hev_socks5_timer_wheel_unlink (HevSocks5TimerWheel *wheel,
+                               HevSocks5TimerNode *node)
+{
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        *node->slot = node->next;
+    if (node->next)
+        node->next->prev = node->prev;
+    wheel->nums--;
+}
+
+static unsigned int
+hev_socks5_timer_wheel_hash (HevSocks5TimerWheel *wheel, HevTask *task)
+{
+    uintptr_t key = (uintptr_t)task >> 4;
+
+    return (key * 2654435761u) & (wheel->hsize - 1);
+}
+
+static HevSocks5TimerNode *
+hev_socks5_timer_wheel_find (HevSocks5TimerWheel *wheel, HevTask *task)
+{
+    HevSocks5TimerNode *node;
+
+    if (!wheel->hsize)
+        return NULL;
+
+    node = wheel->hash[hev_socks5_timer_wheel_hash (wheel, task)];
+    for (; node; node = node->hnext) {
+        if (node->task == task)
+            return node;
+    }
+
+    return NULL;
+}
+
+static int
+hev_socks5_timer_wheel_insert (HevSocks5TimerWheel *wheel,
+                               HevSocks5TimerNode *node)
+{
+    HevSocks5TimerNode **slot;
+
+    if (wheel->hnums >= wheel->hsize) {
+        unsigned int size = wheel->hsize ? wheel->hsize * 2 : 64;
+        HevSocks5TimerNode **hash = wheel->hash;
+        unsigned int i, hsize = wheel->hsize;
+
+        wheel->hash = hev_calloc (size, sizeof (HevSocks5TimerNode *));
+        if (!wheel->hash) {
+            wheel->hash = hash;
+            if (!hsize)
+                return -1;
+        } else {
+            wheel->hsize = size;
+            for (i = 0; i < hsize; i++) {
+                while (hash[i]) {
+                    HevSocks5TimerNode *n = hash[i];
+
+                    hash[i] = n->hnext;
+                    slot = &wheel->hash[hev_socks5_timer_wheel_hash (wheel,
+                                                                     n->task)];
+                    n->hnext = *slot;
+                    *slot = n;
+                }
+            }
+            hev_free (hash);
+        }
+    }
+
+    slot = &wheel->hash[hev_socks5_timer_wheel_hash (wheel, node->task)];
+    node->hnext = *slot;
+    *slot = node;
+    wheel->hnums++;
+
+    return 0;
+}
+
+static void
+hev_socks5_timer_wheel_erase (HevSocks5TimerWheel *wheel,
+                              HevSocks5TimerNode *node)
+{
+    HevSocks5TimerNode **p;
+
+    p = &wheel->hash[hev_socks5_timer_wheel_hash (wheel, node->task)];
+    for (; *p; p = &(*p)->hnext) {
+        if (*p == node) {
+            *p = node->hnext;
+            wheel->hnums--;
+            break;
+        }
+    }
+}
+
+static void
+hev_socks5_timer_wheel_expire (HevSocks5TimerWheel *wheel, int64_t pos)
+{
+    HevSocks5TimerNode *node = wheel->slots[pos % TIMER_WHEEL_SLOTS];
+
+    while (node) {
+        HevSocks5TimerNode *next = node->next;
+        int64_t deadline;
+
+        /* later rounds share the slot and stay */
+        if (node->expire > wheel->now) {
+            node = next;
+            continue;
+        }
+
+        /* I/O since the node was linked only moved the deadline */
+        hev_socks5_timer_wheel_unlink (wheel, node);
+        deadline = node->active + node->timeout;
+        if (deadline > wheel->now) {
+            node->expire = deadline;
+            hev_socks5_timer_wheel_link (wheel, node);
+        } else {
+            hev_socks5_timer_wheel_erase (wheel, node);
+            if (node->waiter) {
+                node->expired = 1;
+                hev_task_wakeup (node->waiter);
+            } else {
+                hev_free (node);
+            }
+        }
+
+        node = next;
+    }
+}
+
+static void
+hev_socks5_timer_wheel_entry (void *data)
+{
+    HevSocks5TimerWheel *wheel = data;
+
+    while (wheel->nums) {
+        int64_t end;
+
+        hev_task_sleep (wheel->tick);
+
+        wheel->now = hev_socks5_now ();
+        end = wheel->now / wheel->tick;
+        if ((end - wheel->pos) >= TIMER_WHEEL_SLOTS)
+            wheel->pos = end - TIMER_WHEEL_SLOTS + 1;
+
+        for (; wheel->pos <= end && wheel->nums; wheel->pos++)
+            hev_socks5_timer_wheel_expire (wheel, wheel->pos);
+    }
+
+    hev_free (wheel->hash);
+    wheel->hash = NULL;
+    wheel->hsize = 0;
+    wheel->ticker = NULL;
+}
+
+static int
+hev_socks5_timer_wheel_start (HevSocks5TimerWheel *wheel)
+{
+    HevTask *task;
+
+    task = hev_task_new (hev_socks5_get_task_stack_size ());
+    if (!task)
+        return -1;
+
+    wheel->tick = timer_tick;
+    wheel->now = hev_socks5_now ();
+    wheel->pos = wheel->now / wheel->tick;
+    wheel->ticker = task;
+    hev_task_run (task, hev_socks5_timer_wheel_entry, wheel);
+
+    return 0;
+}
+
+int
+hev_socks5_task_wait (int timeout)
+{
+    HevSocks5TimerWheel *wheel = &timer_wheel;
+    HevTask *task = hev_task_self ();
+    HevSocks5TimerNode *node;
+    int64_t expire;
+
+    if (!timer_tick || timeout <= 0)
+        return hev_task_sleep (timeout);
+
+    if (!wheel->ticker && hev_socks5_timer_wheel_start (wheel) < 0)
+        return hev_task_sleep (timeout);
+
+    /*
+     * Each task keeps one node linked until its deadline passes without a
+     * wait in flight, so a wait only moves the deadline. It is kept on the
+     * coarse clock of the ticker.
+     */
+    expire = wheel->now + timeout;
+    node = hev_socks5_timer_wheel_find (wheel, task);
+    if (!node) {
+        node = hev_malloc (sizeof (HevSocks5TimerNode));
+        if (!node)
+            return hev_task_sleep (timeout);
+
+        node->task = task;
+        if (hev_socks5_timer_wheel_insert (wheel, node) < 0) {
+            hev_free (node);
+            return hev_task_sleep (timeout);
+        }
+
+        node->expire = expire;
+        hev_socks5_timer_wheel_link (wheel, node);
+    } else if (node->expire > expire) {
+        hev_socks5_timer_wheel_unlink (wheel, node);
+        node->expire = expire;
+        hev_socks5_timer_wheel_link (wheel, node);
+    }
+
+    node->active = wheel->now;
+    node->timeout = timeout;
+    node->expired = 0;
+    node->waiter = task;
+
+    hev_task_yield (HEV_TASK_WAITIO);
+
+    node->waiter = NULL;
+    if (node->expired) {
+        hev_free (node);
+        return 0;
+    }
+
+    return 1;
+}
 
 int
 hev_socks5_task_io_yielder (HevTaskYieldType type, void *data)
@@ -46,7 +437,7 @@ hev_socks5_task_io_yielder (HevTaskYieldType type, void *data)
         hev_task_yield (HEV_TASK_WAITIO);
     } else {
         int timeout = self->timeout;
-        timeout = hev_task_sleep (timeout);
+        timeout = hev_socks5_task_wait (timeout);
         if (timeout <= 0) {
             LOG_I ("%p io timeout", self);
             return -1;
@@ -84,6 +475,52 @@ hev_socks5_socket (int type)
     return fd;
 }
 
+int64_t
+hev_socks5_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+char *
+hev_socks5_strdup (const char *str)
+{
+    size_t len;
+    char *res;
+
+    len = strlen (str) + 1;
+    res = hev_malloc (len);
+    if (res)
+        memcpy (res, str, len);
+
+    return res;
+}
+
+int
+hev_socks5_addr_get_port (const HevSocks5Addr *addr)
+{
+    uint16_t port;
+
+    switch (addr->atype) {
+    case HEV_SOCKS5_ADDR_TYPE_IPV4:
+        port = addr->ipv4.port;
+        break;
+    case HEV_SOCKS5_ADDR_TYPE_IPV6:
+        port = addr->ipv6.port;
+        break;
+    case HEV_SOCKS5_ADDR_TYPE_NAME:
+        memcpy (&port, addr->domain.addr + addr->domain.len, 2);
+        break;
+    default:
+        return 0;
+    }
+
+    return ntohs (port);
+}
+
 const char *
 hev_socks5_addr_into_str (const HevSocks5Addr *addr, char *buf, int len)
 {
@@ -255,125 +692,1049 @@ hev_socks5_name_resolve_ipv6 (const char *name, struct sockaddr_in6 *saddr)
 }
 
 static int
-hev_socks5_name_resolve_name (const char *name, struct sockaddr_in6 *saddr,
-                              int *family)
+hev_socks5_name_into_nameserver (const char *addr, int port,
+                                 struct sockaddr_in6 *saddr)
 {
-    struct addrinfo *result = NULL;
-    struct addrinfo hints = { 0 };
-    int res = 0;
+    memset (saddr, 0, sizeof (struct sockaddr_in6));
+    saddr->sin6_family = AF_INET6;
+    saddr->sin6_port = htons (port);
 
-    hints.ai_family = *family;
-    hints.ai_socktype = SOCK_STREAM;
+    if (hev_socks5_name_resolve_ipv4 (addr, saddr) == 0)
+        return 0;
 
-    hev_task_dns_getaddrinfo (name, NULL, &hints, &result);
-    if (!result)
-        return -1;
+    return hev_socks5_name_resolve_ipv6 (addr, saddr);
+}
 
-    switch (result->ai_family) {
-    case AF_INET: {
-        struct sockaddr_in *sa = (struct sockaddr_in *)result->ai_addr;
-        memset (&saddr->sin6_addr, 0, 10);
-        saddr->sin6_addr.s6_addr[10] = 0xff;
-        saddr->sin6_addr.s6_addr[11] = 0xff;
-        memcpy (&saddr->sin6_addr.s6_addr[12], &sa->sin_addr, 4);
-        *family = HEV_SOCKS5_ADDR_FAMILY_IPV4;
-        break;
-    }
-    case AF_INET6: {
-        struct sockaddr_in6 *sa = (struct sockaddr_in6 *)result->ai_addr;
-        memcpy (&saddr->sin6_addr, &sa->sin6_addr, 16);
-        *family = HEV_SOCKS5_ADDR_FAMILY_IPV6;
-        break;
-    }
-    default:
-        res = -1;
+static void
+hev_socks5_dns_load_conf (void)
+{
+    char line[256];
+    FILE *fp;
+
+    fp = fopen ("/etc/resolv.conf", "r");
+    if (!fp)
+        return;
+
+    while (fgets (line, sizeof (line), fp)) {
+        struct sockaddr_in6 *saddr;
+        char addr[64];
+        int res;
+
+        if (dns_conf_server_nums >= HEV_SOCKS5_DNS_NAMESERVERS)
+            break;
+
+        res = sscanf (line, "nameserver %63s", addr);
+        if (res != 1)
+            continue;
+
+        saddr = &dns_conf_servers[dns_conf_server_nums];
+        res = hev_socks5_name_into_nameserver (addr, 53, saddr);
+        if (res == 0)
+            dns_conf_server_nums++;
     }
 
-    freeaddrinfo (result);
-    return res;
+    fclose (fp);
 }
 
-int
-hev_socks5_name_into_sockaddr6 (const char *name, int port,
-                                struct sockaddr_in6 *saddr, int *family)
+static unsigned int
+hev_socks5_name_hash (const char *name)
 {
-    int res;
+    unsigned int hash = 2166136261u;
 
-    saddr->sin6_family = AF_INET6;
-    saddr->sin6_port = htons (port);
+    for (; *name; name++)
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
 
-    res = hev_socks5_name_resolve_ipv4 (name, saddr);
-    if (res == 0) {
-        *family = HEV_SOCKS5_ADDR_FAMILY_IPV4;
+    return hash;
+}
+
+static int
+hev_socks5_name_query (const char *name, int family, struct in6_addr *addrs,
+                       int nums, int *ttl)
+{
+    struct addrinfo *result = NULL;
+    struct addrinfo hints = { 0 };
+    struct addrinfo *ai;
+    int res, n = 0;
+
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (dns_native)
+        return hev_socks5_resolver_query (name, family, addrs, nums, ttl);
+
+    /* getaddrinfo does not report record TTLs */
+    *ttl = -1;
+
+    res = hev_task_dns_getaddrinfo (name, NULL, &hints, &result);
+    switch (res) {
+    case 0:
+        break;
+    case EAI_NONAME:
+#ifdef EAI_NODATA
+    case EAI_NODATA:
+#endif
         return 0;
+    default:
+        return -1;
     }
-
-    res = hev_socks5_name_resolve_ipv6 (name, saddr);
-    if (res == 0) {
-        *family = HEV_SOCKS5_ADDR_FAMILY_IPV6;
+    if (!result)
         return 0;
+
+    for (ai = result; ai && n < nums; ai = ai->ai_next) {
+        switch (ai->ai_family) {
+        case AF_INET: {
+            struct sockaddr_in *sa = (struct sockaddr_in *)ai->ai_addr;
+            memset (&addrs[n], 0, 10);
+            addrs[n].s6_addr[10] = 0xff;
+            addrs[n].s6_addr[11] = 0xff;
+            memcpy (&addrs[n].s6_addr[12], &sa->sin_addr, 4);
+            n++;
+            break;
+        }
+        case AF_INET6: {
+            struct sockaddr_in6 *sa = (struct sockaddr_in6 *)ai->ai_addr;
+            memcpy (&addrs[n], &sa->sin6_addr, 16);
+            n++;
+            break;
+        }
+        }
     }
 
-    res = hev_socks5_name_resolve_name (name, saddr, family);
-    return res;
+    freeaddrinfo (result);
+    return n;
 }
 
-void
-hev_socks5_set_connect_timeout (int timeout)
+static void
+hev_socks5_dns_cache_wake (HevSocks5DNSEntry *e)
 {
-    connect_timeout = timeout;
-}
+    HevSocks5DNSWaiter *w;
 
-int
-hev_socks5_get_connect_timeout (void)
-{
-    return connect_timeout;
-}
+    for (w = e->waiters; w; w = w->next) {
+        w->done = 1;
+        if (write (w->fds[1], "", 1) < 0)
+            LOG_W ("%p socks5 dns cache wake", e);
+    }
 
-void
-hev_socks5_set_tcp_timeout (int timeout)
-{
-    tcp_timeout = timeout;
+    e->waiters = NULL;
 }
 
-int
-hev_socks5_get_tcp_timeout (void)
+static HevSocks5DNSEntry *
+hev_socks5_dns_cache_find (HevSocks5DNSEntry *set, unsigned int hash,
+                           int family, const char *name)
 {
-    return tcp_timeout;
-}
+    HevSocks5DNSEntry *victim = &set[0];
+    int i;
 
-void
-hev_socks5_set_udp_timeout (int timeout)
-{
-    udp_timeout = timeout;
-}
+    for (i = 0; i < DNS_CACHE_WAYS; i++) {
+        HevSocks5DNSEntry *e = &set[i];
 
-int
-hev_socks5_get_udp_timeout (void)
-{
-    return udp_timeout;
-}
+        if (e->name[0] && e->hash == hash && e->family == family &&
+            strcmp (e->name, name) == 0)
+            return e;
 
-void
-hev_socks5_set_task_stack_size (int stack_size)
-{
-    task_stack_size = stack_size;
-}
+        if (e->expire < victim->expire)
+            victim = e;
+    }
 
-int
-hev_socks5_get_task_stack_size (void)
-{
-    return task_stack_size;
-}
+    hev_socks5_dns_cache_wake (victim);
+    victim->name[0] = '\0';
+    victim->expire = 0;
 
-void
-hev_socks5_set_udp_recv_buffer_size (int buffer_size)
-{
-    udp_recv_buffer_size = buffer_size;
+    return victim;
 }
 
-void
-hev_socks5_set_udp_copy_buffer_nums (int nums)
+static int
+hev_socks5_dns_cache_wait (HevSocks5DNSShard *shard, HevSocks5DNSEntry *e)
+{
+    HevSocks5DNSWaiter w, **p;
+    int64_t expire = e->expire;
+    HevTask *task = hev_task_self ();
+
+    /* Called with the shard locked; returns with it unlocked. */
+    if (pipe (w.fds) < 0) {
+        pthread_mutex_unlock (&shard->lock);
+        return -1;
+    }
+
+    fcntl (w.fds[0], F_SETFL, O_NONBLOCK);
+    fcntl (w.fds[1], F_SETFL, O_NONBLOCK);
+    fcntl (w.fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl (w.fds[1], F_SETFD, FD_CLOEXEC);
+
+    w.done = 0;
+    w.next = e->waiters;
+    e->waiters = &w;
+    pthread_mutex_unlock (&shard->lock);
+
+    hev_task_add_fd (task, w.fds[0], POLLIN);
+    for (;;) {
+        int64_t now = hev_socks5_now ();
+        char c;
+
+        if (read (w.fds[0], &c, 1) == 1 || now >= expire)
+            break;
+        hev_task_sleep (expire - now);
+    }
+    hev_task_del_fd (task, w.fds[0]);
+
+    pthread_mutex_lock (&shard->lock);
+    if (!w.done) {
+        for (p = &e->waiters; *p; p = &(*p)->next) {
+            if (*p == &w) {
+                *p = w.next;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock (&shard->lock);
+
+    close (w.fds[0]);
+    close (w.fds[1]);
+
+    return 0;
+}
+
+static int
+hev_socks5_name_lookup (const char *name, int family, struct in6_addr *addrs,
+                        int nums)
+{
+    struct in6_addr res[HEV_SOCKS5_CONNECT_ADDRS];
+    HevSocks5DNSShard *shard;
+    HevSocks5DNSCache *cache;
+    HevSocks5DNSEntry *e;
+    unsigned int hash;
+    int joined = 0;
+    int ttl, n;
+
+    cache = __atomic_load_n (&dns_cache, __ATOMIC_ACQUIRE);
+    if (!cache || strlen (name) >= sizeof (e->name))
+        return hev_socks5_name_query (name, family, addrs, nums, &ttl);
+
+    hash = hev_socks5_name_hash (name) ^ family;
+    shard = &cache->shards[hash % DNS_CACHE_SHARDS];
+    n = (hash / DNS_CACHE_SHARDS) % cache->sets;
+
+    /*
+     * Lookups for a name that is already being resolved wait for that
+     * query instead of issuing their own, unless it outlives the connect
+     * timeout. Waiters may run on other threads, so each one is woken
+     * through its own pipe.
+     */
+    for (;;) {
+        int64_t now = hev_socks5_now ();
+
+        pthread_mutex_lock (&shard->lock);
+        e = hev_socks5_dns_cache_find (&shard->entries[n * DNS_CACHE_WAYS],
+                                       hash, family, name);
+        if (e->name[0] && now < e->expire) {
+            if (e->nums >= 0) {
+                n = (e->nums < nums) ? e->nums : nums;
+                memcpy (addrs, e->addrs, sizeof (struct in6_addr) * n);
+                pthread_mutex_unlock (&shard->lock);
+                __atomic_add_fetch (&dns_cache_hits, 1, __ATOMIC_RELAXED);
+                return n;
+            }
+            if (!joined) {
+                __atomic_add_fetch (&dns_cache_joins, 1, __ATOMIC_RELAXED);
+                joined = 1;
+            }
+            if (hev_socks5_dns_cache_wait (shard, e) < 0)
+                return hev_socks5_name_query (name, family, addrs, nums,
+                                              &ttl);
+            continue;
+        }
+
+        e->hash = hash;
+        e->family = family;
+        e->nums = -1;
+        e->expire = now + connect_timeout;
+        strcpy (e->name, name);
+        pthread_mutex_unlock (&shard->lock);
+        break;
+    }
+
+    __atomic_add_fetch (&dns_cache_misses, 1, __ATOMIC_RELAXED);
+    n = hev_socks5_name_query (name, family, res, HEV_SOCKS5_CONNECT_ADDRS,
+                               &ttl);
+
+    if (n == 0)
+        ttl = dns_cache_neg_ttl;
+    else if (ttl < dns_cache_min_ttl)
+        ttl = dns_cache_min_ttl;
+    else if (ttl > dns_cache_max_ttl)
+        ttl = dns_cache_max_ttl;
+
+    /* Transient failures are not cached; the waiters retry on their own. */
+    pthread_mutex_lock (&shard->lock);
+    if (e->nums < 0 && e->hash == hash && e->family == family &&
+        strcmp (e->name, name) == 0) {
+        if (n < 0) {
+            e->name[0] = '\0';
+            e->expire = 0;
+        } else {
+            memcpy (e->addrs, res, sizeof (struct in6_addr) * n);
+            e->nums = n;
+            e->expire = hev_socks5_now () + ttl;
+        }
+        hev_socks5_dns_cache_wake (e);
+    }
+    pthread_mutex_unlock (&shard->lock);
+
+    if (n <= 0)
+        return n;
+
+    n = (n < nums) ? n : nums;
+    memcpy (addrs, res, sizeof (struct in6_addr) * n);
+
+    return n;
+}
+
+static int
+hev_socks5_name_resolve_name (const char *name, struct sockaddr_in6 *saddr,
+                              int *family)
+{
+    int res;
+
+    res = hev_socks5_name_lookup (name, *family, &saddr->sin6_addr, 1);
+    if (res <= 0)
+        return -1;
+
+    if (IN6_IS_ADDR_V4MAPPED (&saddr->sin6_addr))
+        *family = HEV_SOCKS5_ADDR_FAMILY_IPV4;
+    else
+        *family = HEV_SOCKS5_ADDR_FAMILY_IPV6;
+
+    return 0;
+}
+
+int
+hev_socks5_name_into_sockaddr6 (const char *name, int port,
+                                struct sockaddr_in6 *saddr, int *family)
+{
+    int res;
+
+    saddr->sin6_family = AF_INET6;
+    saddr->sin6_port = htons (port);
+
+    res = hev_socks5_name_resolve_ipv4 (name, saddr);
+    if (res == 0) {
+        *family = HEV_SOCKS5_ADDR_FAMILY_IPV4;
+        return 0;
+    }
+
+    res = hev_socks5_name_resolve_ipv6 (name, saddr);
+    if (res == 0) {
+        *family = HEV_SOCKS5_ADDR_FAMILY_IPV6;
+        return 0;
+    }
+
+    res = hev_socks5_name_resolve_name (name, saddr, family);
+    return res;
+}
+
+static int
+hev_socks5_name_get_family (const char *name)
+{
+    unsigned int hash = hev_socks5_name_hash (name);
+    unsigned int val;
+    int idx;
+
+    idx = hash % (sizeof (family_cache) / sizeof (family_cache[0]));
+    val = __atomic_load_n (&family_cache[idx], __ATOMIC_RELAXED);
+    if ((val & ~3u) != (hash & ~3u))
+        return HEV_SOCKS5_ADDR_FAMILY_UNSPEC;
+
+    switch (val & 3) {
+    case 1:
+        return HEV_SOCKS5_ADDR_FAMILY_IPV4;
+    case 2:
+        return HEV_SOCKS5_ADDR_FAMILY_IPV6;
+    default:
+        return HEV_SOCKS5_ADDR_FAMILY_UNSPEC;
+    }
+}
+
+static void
+hev_socks5_name_set_family (const char *name, int family)
+{
+    unsigned int hash = hev_socks5_name_hash (name);
+    unsigned int val;
+    int idx;
+
+    idx = hash % (sizeof (family_cache) / sizeof (family_cache[0]));
+    val = hash & ~3u;
+    val |= (family == HEV_SOCKS5_ADDR_FAMILY_IPV4) ? 1 : 2;
+    __atomic_store_n (&family_cache[idx], val, __ATOMIC_RELAXED);
+}
+
+static int
+hev_socks5_name_resolve_names (const char *name, int port,
+                               struct sockaddr_in6 *saddrs, int nums,
+                               int *family)
+{
+    struct in6_addr addrs[nums];
+    struct in6_addr v4[nums];
+    struct in6_addr v6[nums];
+    int n4 = 0, n6 = 0;
+    int i4 = 0, i6 = 0;
+    int v4first;
+    int n, i;
+
+    n = hev_socks5_name_lookup (name, *family, addrs, nums);
+    if (n <= 0)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        if (IN6_IS_ADDR_V4MAPPED (&addrs[i]))
+            v4[n4++] = addrs[i];
+        else
+            v6[n6++] = addrs[i];
+    }
+
+    /* RFC 8305: IPv6 first unless IPv4 won last time, then interleave */
+    v4first = hev_socks5_name_get_family (name) == HEV_SOCKS5_ADDR_FAMILY_IPV4;
+    if (!n6)
+        v4first = 1;
+    else if (!n4)
+        v4first = 0;
+
+    for (i = 0; i < nums && (i4 < n4 || i6 < n6); i++) {
+        int use4;
+
+        if (i4 >= n4)
+            use4 = 0;
+        else if (i6 >= n6)
+            use4 = 1;
+        else
+            use4 = v4first ^ (i & 1);
+
+        memset (&saddrs[i], 0, sizeof (struct sockaddr_in6));
+        saddrs[i].sin6_family = AF_INET6;
+        saddrs[i].sin6_port = htons (port);
+        saddrs[i].sin6_addr = use4 ? v4[i4++] : v6[i6++];
+    }
+
+    if (v4first)
+        *family = HEV_SOCKS5_ADDR_FAMILY_IPV4;
+    else
+        *family = HEV_SOCKS5_ADDR_FAMILY_IPV6;
+
+    return i;
+}
+
+int
+hev_socks5_name_into_sockaddr6v (const char *name, int port,
+                                 struct sockaddr_in6 *saddrs, int nums,
+                                 int *family)
+{
+    int res;
+
+    memset (&saddrs[0], 0, sizeof (struct sockaddr_in6));
+    saddrs[0].sin6_family = AF_INET6;
+    saddrs[0].sin6_port = htons (port);
+
+    res = hev_socks5_name_resolve_ipv4 (name, &saddrs[0]);
+    if (res == 0) {
+        *family = HEV_SOCKS5_ADDR_FAMILY_IPV4;
+        return 1;
+    }
+
+    res = hev_socks5_name_resolve_ipv6 (name, &saddrs[0]);
+    if (res == 0) {
+        *family = HEV_SOCKS5_ADDR_FAMILY_IPV6;
+        return 1;
+    }
+
+    return hev_socks5_name_resolve_names (name, port, saddrs, nums, family);
+}
+
+static int
+hev_socks5_connect_start (HevSocks5 *self, struct sockaddr_in6 *saddr,
+                          HevSocks5FastOpen *tfo)
+{
+    HevSocks5Class *klass;
+    struct sockaddr *sap;
+    int fd, res;
+
+    fd = hev_socks5_socket (SOCK_STREAM);
+    if (fd < 0) {
+        LOG_E ("%p socks5 socket stream", self);
+        return -1;
+    }
+
+    sap = (struct sockaddr *)saddr;
+    klass = HEV_OBJECT_GET_CLASS (self);
+    res = klass->binder (self, fd, sap);
+    if (res < 0) {
+        LOG_W ("%p socks5 bind", self);
+        goto err;
+    }
+
+    res = hev_socks5_egress_bind (fd, saddr);
+    if (res < 0) {
+        LOG_W ("%p socks5 egress bind", self);
+        goto err;
+    }
+
+    if (tfo) {
+        int one = 1;
+
+        res = setsockopt (fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &one,
+                          sizeof (one));
+        if (res < 0)
+            tfo = NULL;
+    }
+
+    res = connect (fd, sap, sizeof (struct sockaddr_in6));
+    if (res < 0 && errno != EINPROGRESS)
+        goto err;
+
+    /*
+     * With fast open armed connect only defers the SYN: data written now
+     * rides in it, otherwise the first write of the caller does.
+     */
+    if (tfo && tfo->len) {
+        ssize_t s;
+
+        s = send (fd, tfo->data, tfo->len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        tfo->sent = (s > 0) ? s : 0;
+    }
+
+    return fd;
+
+err:
+    hev_task_del_fd (hev_task_self (), fd);
+    close (fd);
+    return -1;
+}
+
+static int
+hev_socks5_connect_race_within (HevSocks5 *self, const int *timeout,
+                                struct sockaddr_in6 *saddrs, int nums,
+                                int *index, HevSocks5FastOpen *tfo)
+{
+    struct pollfd pfds[nums];
+    int64_t deadline = -1;
+    int64_t next;
+    int started = 0;
+    int pending = 0;
+    int fd = -1;
+    int i;
+
+    next = hev_socks5_now ();
+    if (*timeout >= 0)
+        deadline = next + *timeout;
+
+    /* fast open would make every attempt win at once, so not for races */
+    if (tfo)
+        tfo->sent = 0;
+    if (!tcp_fastopen || nums > 1)
+        tfo = NULL;
+
+    /*
+     * Happy Eyeballs (RFC 8305): attempts start one after another, 250 ms
+     * apart or as soon as the previous one fails, and the first connection
+     * that completes wins. Everything runs in the calling task.
+     */
+    for (;;) {
+        int64_t now = hev_socks5_now ();
+        int64_t wait;
+
+        if (started < nums && (now >= next || !pending)) {
+            struct pollfd *pfd = &pfds[started];
+
+            pfd->fd = hev_socks5_connect_start (self, &saddrs[started], tfo);
+            pfd->events = POLLOUT;
+            pfd->revents = 0;
+            if (pfd->fd >= 0)
+                pending++;
+            started++;
+            next = now + 250;
+            continue;
+        }
+
+        if (poll (pfds, started, 0) > 0) {
+            for (i = 0; i < started; i++) {
+                socklen_t len = sizeof (int);
+                int err = 0;
+
+                if (pfds[i].fd < 0 || !pfds[i].revents)
+                    continue;
+
+                getsockopt (pfds[i].fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (!err && (pfds[i].revents & POLLOUT)) {
+                    fd = pfds[i].fd;
+                    *index = i;
+                    break;
+                }
+
+                hev_task_del_fd (hev_task_self (), pfds[i].fd);
+                close (pfds[i].fd);
+                pfds[i].fd = -1;
+                pending--;
+                next = now;
+            }
+        }
+
+        if (fd >= 0 || (!pending && started == nums))
+            break;
+
+        if (!*timeout || (deadline >= 0 && now >= deadline)) {
+            LOG_I ("%p io timeout", self);
+            break;
+        }
+
+        wait = (started < nums) ? next - now : -1;
+        if (deadline >= 0 && (wait < 0 || wait > (deadline - now)))
+            wait = deadline - now;
+
+        if (wait < 0)
+            hev_task_yield (HEV_TASK_WAITIO);
+        else if (wait > 0)
+            hev_task_sleep (wait);
+    }
+
+    for (i = 0; i < started; i++) {
+        if (pfds[i].fd < 0 || pfds[i].fd == fd)
+            continue;
+
+        hev_task_del_fd (hev_task_self (), pfds[i].fd);
+        close (pfds[i].fd);
+    }
+
+    return fd;
+}
+
+int
+hev_socks5_connect_race (HevSocks5 *self, struct sockaddr_in6 *saddrs,
+                         int nums, int *index, HevSocks5FastOpen *tfo)
+{
+    return hev_socks5_connect_race_within (self, &self->timeout, saddrs, nums,
+                                           index, tfo);
+}
+
+static void
+hev_socks5_addr_into_name (const HevSocks5Addr *addr, char *name, int *port)
+{
+    uint16_t nport;
+
+    memcpy (name, addr->domain.addr, addr->domain.len);
+    name[addr->domain.len] = '\0';
+    memcpy (&nport, addr->domain.addr + addr->domain.len, 2);
+    *port = ntohs (nport);
+}
+
+int
+hev_socks5_addr_into_sockaddr6v (const HevSocks5Addr *addr,
+                                 struct sockaddr_in6 *saddrs, int nums,
+                                 int *family)
+{
+    int res;
+
+    if (addr->atype == HEV_SOCKS5_ADDR_TYPE_NAME) {
+        char name[256];
+        int port;
+
+        hev_socks5_addr_into_name (addr, name, &port);
+        return hev_socks5_name_into_sockaddr6v (name, port, saddrs, nums,
+                                                family);
+    }
+
+    memset (&saddrs[0], 0, sizeof (struct sockaddr_in6));
+    res = hev_socks5_addr_into_sockaddr6 (addr, &saddrs[0], family);
+    if (res < 0)
+        return -1;
+
+    return 1;
+}
+
+static int
+hev_socks5_connect_sockaddrs (HevSocks5 *self, const int *timeout,
+                              const char *name, struct sockaddr_in6 *saddrs,
+                              int nums, struct sockaddr_in6 *saddr,
+                              HevSocks5FastOpen *tfo)
+{
+    int family;
+    int idx;
+    int fd;
+
+    fd = hev_socks5_connect_race_within (self, timeout, saddrs, nums, &idx,
+                                         tfo);
+    if (fd < 0)
+        return -1;
+
+    *saddr = saddrs[idx];
+    if (IN6_IS_ADDR_V4MAPPED (&saddr->sin6_addr))
+        family = HEV_SOCKS5_ADDR_FAMILY_IPV4;
+    else
+        family = HEV_SOCKS5_ADDR_FAMILY_IPV6;
+    hev_socks5_set_addr_family (self, family);
+
+    if (name && nums > 1)
+        hev_socks5_name_set_family (name, family);
+
+    return fd;
+}
+
+int
+hev_socks5_connect_resolved (HevSocks5 *self, const int *timeout,
+                             const HevSocks5Addr *addr,
+                             struct sockaddr_in6 *saddrs, int nums,
+                             struct sockaddr_in6 *saddr,
+                             HevSocks5FastOpen *tfo)
+{
+    if (addr->atype == HEV_SOCKS5_ADDR_TYPE_NAME) {
+        char name[256];
+        int port;
+
+        hev_socks5_addr_into_name (addr, name, &port);
+        return hev_socks5_connect_sockaddrs (self, timeout, name, saddrs, nums,
+                                             saddr, tfo);
+    }
+
+    return hev_socks5_connect_sockaddrs (self, timeout, NULL, saddrs, nums,
+                                         saddr, tfo);
+}
+
+int
+hev_socks5_connect_name (HevSocks5 *self, const char *name, int port,
+                         struct sockaddr_in6 *saddr, HevSocks5FastOpen *tfo)
+{
+    struct sockaddr_in6 saddrs[HEV_SOCKS5_CONNECT_ADDRS];
+    int family;
+    int nums;
+
+    family = hev_socks5_get_addr_family (self);
+    nums = hev_socks5_name_into_sockaddr6v (name, port, saddrs,
+                                            HEV_SOCKS5_CONNECT_ADDRS, &family);
+    if (nums <= 0)
+        return -2;
+
+    return hev_socks5_connect_sockaddrs (self, &self->timeout, name, saddrs,
+                                         nums, saddr, tfo);
+}
+
+int
+hev_socks5_egress_bind (int fd, const struct sockaddr_in6 *dest)
+{
+    struct sockaddr_in6 addr;
+    socklen_t len = sizeof (addr);
+    int v4, one = 1;
+    unsigned int k;
+    int i, m, res;
+
+    if (!egress_source_nums)
+        return 0;
+
+    /* a custom binder that picked a source wins */
+    res = getsockname (fd, (struct sockaddr *)&addr, &len);
+    if (res < 0 || !IN6_IS_ADDR_UNSPECIFIED (&addr.sin6_addr))
+        return 0;
+
+    v4 = IN6_IS_ADDR_V4MAPPED (&dest->sin6_addr);
+    for (i = 0, m = 0; i < egress_source_nums; i++) {
+        if (IN6_IS_ADDR_V4MAPPED (&egress_sources[i].sin6_addr) == v4)
+            m++;
+    }
+    if (!m)
+        return 0;
+
+    if (egress_policy == HEV_SOCKS5_EGRESS_POLICY_HASH) {
+        const uint8_t *p = (const uint8_t *)&dest->sin6_addr;
+
+        for (i = 0, k = 2166136261u; i < 16; i++)
+            k = (k ^ p[i]) * 16777619u;
+    } else {
+        k = __atomic_fetch_add (&egress_cursor, 1, __ATOMIC_RELAXED);
+    }
+
+    k %= m;
+    for (i = 0; i < egress_source_nums; i++) {
+        if (IN6_IS_ADDR_V4MAPPED (&egress_sources[i].sin6_addr) != v4)
+            continue;
+        if (k-- == 0)
+            break;
+    }
+
+    /* leave the port to connect, so sources are not limited by bind */
+    setsockopt (fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof (one));
+
+    res = bind (fd, (struct sockaddr *)&egress_sources[i],
+                sizeof (struct sockaddr_in6));
+    if (res < 0)
+        return -1;
+
+    __atomic_add_fetch (&egress_used[i], 1, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+const HevSocks5SocketProfile *
+hev_socks5_get_socket_profile (HevSocks5Type type, int port)
+{
+    int i;
+
+    for (i = 0; port && i < HEV_SOCKS5_SOCKET_PROFILE_PORTS; i++) {
+        if (port_profiles[i].port == port)
+            return port_profiles[i].profile;
+    }
+
+    return type_profiles[type];
+}
+
+static void
+hev_socks5_socket_dead_peer_apply (int fd, const HevSocks5SocketProfile *p)
+{
+    int timeout = tcp_user_timeout;
+    int idle = tcp_keepidle;
+    int intvl = tcp_keepintvl;
+    int cnt = tcp_keepcnt;
+    int one = 1;
+
+    if (p && p->user_timeout)
+        timeout = p->user_timeout;
+    if (p && p->keepidle) {
+        idle = p->keepidle;
+        intvl = p->keepintvl;
+        cnt = p->keepcnt;
+    }
+
+    if (timeout)
+        setsockopt (fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout,
+                    sizeof (timeout));
+
+    if (!idle)
+        return;
+
+    setsockopt (fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof (one));
+    setsockopt (fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof (idle));
+    if (intvl)
+        setsockopt (fd, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof (intvl));
+    if (cnt)
+        setsockopt (fd, IPPROTO_TCP, TCP_KEEPCNT, &cnt, sizeof (cnt));
+}
+
+void
+hev_socks5_socket_profile_apply (int fd, const HevSocks5SocketProfile *profile)
+{
+    const HevSocks5SocketProfile *p = profile;
+    socklen_t len = sizeof (int);
+    int one = 1;
+    int type;
+
+    if (getsockopt (fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0)
+        return;
+
+    if (type == SOCK_STREAM)
+        hev_socks5_socket_dead_peer_apply (fd, p);
+
+    if (!p)
+        return;
+
+    if (p->sndbuf)
+        setsockopt (fd, SOL_SOCKET, SO_SNDBUF, &p->sndbuf, sizeof (int));
+    if (p->rcvbuf)
+        setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &p->rcvbuf, sizeof (int));
+    if (p->priority)
+        setsockopt (fd, SOL_SOCKET, SO_PRIORITY, &p->priority, sizeof (int));
+
+    if (type != SOCK_STREAM)
+        return;
+
+    if (p->nodelay)
+        setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+    if (p->quickack)
+        setsockopt (fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof (one));
+    if (p->notsent_lowat)
+        setsockopt (fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &p->notsent_lowat,
+                    sizeof (int));
+    if (p->congestion)
+        setsockopt (fd, IPPROTO_TCP, TCP_CONGESTION, p->congestion,
+                    strlen (p->congestion));
+}
+
+void
+hev_socks5_set_handshake_timeout (int timeout, int min_rate)
+{
+    handshake_timeout = timeout;
+    handshake_min_rate = min_rate;
+}
+
+int
+hev_socks5_get_handshake_timeout (void)
+{
+    return handshake_timeout;
+}
+
+int
+hev_socks5_get_handshake_min_rate (void)
+{
+    return handshake_min_rate;
+}
+
+void
+hev_socks5_get_handshake_stats (unsigned int *greeting, unsigned int *auth,
+                                unsigned int *request)
+{
+    *greeting = __atomic_load_n (&handshake_timeouts[0], __ATOMIC_RELAXED);
+    *auth = __atomic_load_n (&handshake_timeouts[1], __ATOMIC_RELAXED);
+    *request = __atomic_load_n (&handshake_timeouts[2], __ATOMIC_RELAXED);
+}
+
+void
+hev_socks5_handshake_account (HevSocks5HandshakePhase phase)
+{
+    __atomic_add_fetch (&handshake_timeouts[phase], 1, __ATOMIC_RELAXED);
+}
+
+void
+hev_socks5_set_timer_tick (int tick)
+{
+    timer_tick = tick;
+}
+
+void
+hev_socks5_set_connect_timeout (int timeout)
+{
+    connect_timeout = timeout;
+}
+
+int
+hev_socks5_get_connect_timeout (void)
+{
+    return connect_timeout;
+}
+
+void
+hev_socks5_set_connect_optimistic (int optimistic)
+{
+    connect_optimistic = optimistic;
+}
+
+int
+hev_socks5_get_connect_optimistic (void)
+{
+    return connect_optimistic;
+}
+
+void
+hev_socks5_set_connect_speculative (int speculative)
+{
+    connect_speculative = speculative;
+}
+
+int
+hev_socks5_get_connect_speculative (void)
+{
+    return connect_speculative;
+}
+
+void
+hev_socks5_set_tcp_timeout (int timeout)
+{
+    tcp_timeout = timeout;
+}
+
+int
+hev_socks5_get_tcp_timeout (void)
+{
+    return tcp_timeout;
+}
+
+void
+hev_socks5_set_udp_timeout (int timeout)
+{
+    udp_timeout = timeout;
+}
+
+int
+hev_socks5_get_udp_timeout (void)
+{
+    return udp_timeout;
+}
+
+void
+hev_socks5_set_tcp_duplex_threshold (int threshold)
+{
+    tcp_duplex_threshold = threshold;
+}
+
+int
+hev_socks5_get_tcp_duplex_threshold (void)
+{
+    return tcp_duplex_threshold;
+}
+
+void
+hev_socks5_set_tcp_duplex_threaded (int threaded)
+{
+    tcp_duplex_threaded = threaded;
+}
+
+int
+hev_socks5_get_tcp_duplex_threaded (void)
+{
+    return tcp_duplex_threaded;
+}
+
+void
+hev_socks5_set_tcp_fastopen (int enabled)
+{
+    tcp_fastopen = enabled;
+}
+
+void
+hev_socks5_get_tcp_fastopen_stats (unsigned int *syn_data,
+                                   unsigned int *fallbacks)
+{
+    *syn_data = __atomic_load_n (&tcp_fastopen_syn_data, __ATOMIC_RELAXED);
+    *fallbacks = __atomic_load_n (&tcp_fastopen_fallbacks, __ATOMIC_RELAXED);
+}
+
+void
+hev_socks5_tcp_fastopen_account (int fd)
+{
+    struct tcp_info info;
+    socklen_t len;
+    int val = 0;
+    int res;
+
+    len = sizeof (val);
+    res = getsockopt (fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &val, &len);
+    if (res < 0 || !val)
+        return;
+
+    len = sizeof (info);
+    res = getsockopt (fd, IPPROTO_TCP, TCP_INFO, &info, &len);
+    if (res < 0)
+        return;
+
+    if (info.tcpi_options & TCPI_OPT_SYN_DATA)
+        __atomic_add_fetch (&tcp_fastopen_syn_data, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_add_fetch (&tcp_fastopen_fallbacks, 1, __ATOMIC_RELAXED);
+}
+
+void
+hev_socks5_set_task_stack_size (int stack_size)
+{
+    task_stack_size = stack_size;
+}
+
+int
+hev_socks5_get_task_stack_size (void)
+{
+    return task_stack_size;
+}
+
+void
+hev_socks5_set_udp_recv_buffer_size (int buffer_size)
+{
+    udp_recv_buffer_size = buffer_size;
+}
+
+void
+hev_socks5_set_udp_copy_buffer_nums (int nums)
 {
     udp_copy_buffer_nums = nums;
 }
@@ -383,3 +1744,239 @@ hev_socks5_get_udp_copy_buffer_nums (void)
 {
     return udp_copy_buffer_nums;
 }
+
+void
+hev_socks5_set_udp_shard_nums (int nums)
+{
+    udp_shard_nums = nums;
+}
+
+int
+hev_socks5_get_udp_shard_nums (void)
+{
+    return udp_shard_nums;
+}
+
+void
+hev_socks5_set_udp_shard_rate (int rate)
+{
+    udp_shard_rate = rate;
+}
+
+int
+hev_socks5_get_udp_shard_rate (void)
+{
+    return udp_shard_rate;
+}
+
+void
+hev_socks5_set_worker_nums (int nums)
+{
+    worker_nums = nums;
+}
+
+int
+hev_socks5_get_worker_nums (void)
+{
+    long nums = worker_nums;
+
+    if (nums <= 0)
+        nums = sysconf (_SC_NPROCESSORS_ONLN);
+    if (nums <= 0)
+        nums = 1;
+
+    return nums;
+}
+
+int
+hev_socks5_set_dns_cache_size (int size)
+{
+    HevSocks5DNSCache *cache;
+    HevSocks5DNSEntry *entries;
+    size_t len;
+    int sets, i;
+
+    if (dns_cache)
+        return -1;
+
+    if (size <= 0)
+        return 0;
+
+    sets = size / (DNS_CACHE_SHARDS * DNS_CACHE_WAYS);
+    if (sets == 0)
+        sets = 1;
+
+    len = sizeof (HevSocks5DNSCache);
+    len += sizeof (HevSocks5DNSEntry) * DNS_CACHE_SHARDS * sets *
+           DNS_CACHE_WAYS;
+    cache = calloc (1, len);
+    if (!cache)
+        return -1;
+
+    cache->sets = sets;
+    entries = (HevSocks5DNSEntry *)&cache[1];
+    for (i = 0; i < DNS_CACHE_SHARDS; i++) {
+        pthread_mutex_init (&cache->shards[i].lock, NULL);
+        cache->shards[i].entries = &entries[i * sets * DNS_CACHE_WAYS];
+    }
+
+    __atomic_store_n (&dns_cache, cache, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+void
+hev_socks5_set_dns_cache_ttl (int min_ttl, int max_ttl, int neg_ttl)
+{
+    dns_cache_min_ttl = min_ttl;
+    dns_cache_max_ttl = max_ttl;
+    dns_cache_neg_ttl = neg_ttl;
+}
+
+void
+hev_socks5_get_dns_cache_stats (unsigned int *hits, unsigned int *misses,
+                                unsigned int *joins)
+{
+    *hits = __atomic_load_n (&dns_cache_hits, __ATOMIC_RELAXED);
+    *misses = __atomic_load_n (&dns_cache_misses, __ATOMIC_RELAXED);
+    *joins = __atomic_load_n (&dns_cache_joins, __ATOMIC_RELAXED);
+}
+
+void
+hev_socks5_set_dns_native (int native)
+{
+    dns_native = native;
+}
+
+void
+hev_socks5_set_dns_timeout (int timeout, int attempts)
+{
+    dns_timeout = timeout;
+    dns_attempts = attempts;
+}
+
+int
+hev_socks5_add_dns_nameserver (const char *addr, int port)
+{
+    struct sockaddr_in6 *saddr;
+    int res;
+
+    if (dns_server_nums >= HEV_SOCKS5_DNS_NAMESERVERS)
+        return -1;
+
+    saddr = &dns_servers[dns_server_nums];
+    res = hev_socks5_name_into_nameserver (addr, port, saddr);
+    if (res < 0)
+        return -1;
+
+    dns_server_nums++;
+    return 0;
+}
+
+int
+hev_socks5_get_dns_nameservers (struct sockaddr_in6 *servers)
+{
+    int size = sizeof (struct sockaddr_in6);
+
+    if (dns_server_nums) {
+        memcpy (servers, dns_servers, size * dns_server_nums);
+        return dns_server_nums;
+    }
+
+    pthread_once (&dns_conf_once, hev_socks5_dns_load_conf);
+    memcpy (servers, dns_conf_servers, size * dns_conf_server_nums);
+
+    return dns_conf_server_nums;
+}
+
+int
+hev_socks5_get_dns_timeout (void)
+{
+    return dns_timeout;
+}
+
+int
+hev_socks5_get_dns_attempts (void)
+{
+    return dns_attempts;
+}
+
+int
+hev_socks5_add_egress_source (const char *addr)
+{
+    struct sockaddr_in6 *saddr;
+    int res;
+
+    if (egress_source_nums >= HEV_SOCKS5_EGRESS_SOURCES)
+        return -1;
+
+    saddr = &egress_sources[egress_source_nums];
+    res = hev_socks5_name_into_nameserver (addr, 0, saddr);
+    if (res < 0)
+        return -1;
+
+    egress_source_nums++;
+    return 0;
+}
+
+void
+hev_socks5_set_egress_policy (HevSocks5EgressPolicy policy)
+{
+    egress_policy = policy;
+}
+
+int
+hev_socks5_get_egress_stats (unsigned int *used, int nums)
+{
+    int i;
+
+    for (i = 0; i < nums && i < egress_source_nums; i++)
+        used[i] = __atomic_load_n (&egress_used[i], __ATOMIC_RELAXED);
+
+    return egress_source_nums;
+}
+
+void
+hev_socks5_set_tcp_user_timeout (int timeout)
+{
+    tcp_user_timeout = timeout;
+}
+
+void
+hev_socks5_set_tcp_keepalive (int idle, int intvl, int cnt)
+{
+    tcp_keepidle = idle;
+    tcp_keepintvl = intvl;
+    tcp_keepcnt = cnt;
+}
+
+void
+hev_socks5_set_socket_profile (HevSocks5Type type,
+                               const HevSocks5SocketProfile *profile)
+{
+    type_profiles[type] = profile;
+}
+
+int
+hev_socks5_set_socket_profile_port (int port,
+                                    const HevSocks5SocketProfile *profile)
+{
+    int i, n = -1;
+
+    for (i = 0; i < HEV_SOCKS5_SOCKET_PROFILE_PORTS; i++) {
+        if (port_profiles[i].port == port) {
+            n = i;
+            break;
+        }
+        if (n < 0 && !port_profiles[i].port)
+            n = i;
+    }
+
+    if (n < 0 || !port)
+        return -1;
+
+    port_profiles[n].port = profile ? port : 0;
+    port_profiles[n].profile = profile;
+
+    return 0;
+}
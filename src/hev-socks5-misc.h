@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-socks5-misc.h
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2021 - 2025 hev
+ Copyright   : Copyright (c) 2021 - 2026 hev
  Description : Socks5 Misc
  ============================================================================
  */
@@ -14,22 +14,118 @@
 
 #include <hev-task.h>
 
+#include "hev-socks5.h"
 #include "hev-socks5-proto.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef enum _HevSocks5EgressPolicy HevSocks5EgressPolicy;
+typedef struct _HevSocks5SocketProfile HevSocks5SocketProfile;
+
+enum _HevSocks5EgressPolicy
+{
+    HEV_SOCKS5_EGRESS_POLICY_ROUND_ROBIN,
+    HEV_SOCKS5_EGRESS_POLICY_HASH,
+};
+
+/* Socket options for a session; zero fields keep the system default. */
+struct _HevSocks5SocketProfile
+{
+    int nodelay;
+    int quickack;
+    int notsent_lowat;
+    int sndbuf;
+    int rcvbuf;
+    int priority;
+    int user_timeout;
+    int keepidle;
+    int keepintvl;
+    int keepcnt;
+    const char *congestion;
+};
+
 int hev_socks5_task_io_yielder (HevTaskYieldType type, void *data);
 
 void hev_socks5_set_connect_timeout (int timeout);
 void hev_socks5_set_tcp_timeout (int timeout);
 void hev_socks5_set_udp_timeout (int timeout);
 
+/* Bounds the server handshake by a total deadline and a minimum rate. */
+void hev_socks5_set_handshake_timeout (int timeout, int min_rate);
+void hev_socks5_get_handshake_stats (unsigned int *greeting,
+                                     unsigned int *auth,
+                                     unsigned int *request);
+
+/* Caps server handshakes in flight and rate limits each client address. */
+void hev_socks5_set_handshake_limit (int limit);
+int hev_socks5_set_client_rate_limit (int rate, int burst, int size);
+void hev_socks5_get_admission_stats (unsigned int *handshakes,
+                                     unsigned int *over_limit,
+                                     unsigned int *over_rate);
+
+/* Fails connects fast to destinations whose recent connects failed. */
+int hev_socks5_set_connect_breaker (int failures, int backoff, int pending,
+                                    int size);
+void hev_socks5_get_connect_breaker_stats (unsigned int *trips,
+                                           unsigned int *rejects);
+
+/* Keeps I/O timeouts on a per-thread timer wheel of tick ms. */
+void hev_socks5_set_timer_tick (int tick);
+
+/* Replies success to CONNECT before the upstream connect completes. */
+void hev_socks5_set_connect_optimistic (int optimistic);
+
+/* Resolves (1) or also connects (2) a pipelined CONNECT during auth. */
+void hev_socks5_set_connect_speculative (int speculative);
+
+/* Copies each direction of TCP sessions above threshold B/s separately. */
+void hev_socks5_set_tcp_duplex_threshold (int threshold);
+void hev_socks5_set_tcp_duplex_threaded (int threaded);
+
+/* Carries handshakes and early data in the SYN of upstream connects. */
+void hev_socks5_set_tcp_fastopen (int enabled);
+void hev_socks5_get_tcp_fastopen_stats (unsigned int *syn_data,
+                                        unsigned int *fallbacks);
+
 void hev_socks5_set_task_stack_size (int stack_size);
 void hev_socks5_set_udp_recv_buffer_size (int buffer_size);
 void hev_socks5_set_udp_copy_buffer_nums (int nums);
 
+/* Splits UDP associations above rate datagrams per second into shards. */
+void hev_socks5_set_udp_shard_nums (int nums);
+void hev_socks5_set_udp_shard_rate (int rate);
+
+/* Sets the size of the shared worker thread pool, 0 for one per CPU. */
+void hev_socks5_set_worker_nums (int nums);
+
+/* Caches name lookups for all threads; the size can be set only once. */
+int hev_socks5_set_dns_cache_size (int size);
+void hev_socks5_set_dns_cache_ttl (int min_ttl, int max_ttl, int neg_ttl);
+void hev_socks5_get_dns_cache_stats (unsigned int *hits, unsigned int *misses,
+                                     unsigned int *joins);
+
+/* Resolves names with the built-in stub resolver instead of getaddrinfo. */
+void hev_socks5_set_dns_native (int native);
+void hev_socks5_set_dns_timeout (int timeout, int attempts);
+int hev_socks5_add_dns_nameserver (const char *addr, int port);
+
+/* Binds upstream TCP sockets to a pool of local source addresses. */
+int hev_socks5_add_egress_source (const char *addr);
+void hev_socks5_set_egress_policy (HevSocks5EgressPolicy policy);
+int hev_socks5_get_egress_stats (unsigned int *used, int nums);
+
+/* Detects dead peers with TCP_USER_TIMEOUT and keepalive probes. */
+void hev_socks5_set_tcp_user_timeout (int timeout);
+void hev_socks5_set_tcp_keepalive (int idle, int intvl, int cnt);
+
+/* Picks profiles by user, then destination port, then session type. */
+void hev_socks5_set_socket_profile (HevSocks5Type type,
+                                    const HevSocks5SocketProfile *profile);
+int hev_socks5_set_socket_profile_port (int port,
+                                        const HevSocks5SocketProfile *profile);
+
 int hev_socks5_addr_len (const HevSocks5Addr *addr);
 int hev_socks5_addr_from_name (HevSocks5Addr *addr, const char *name, int port);
 int hev_socks5_addr_from_ipv4 (HevSocks5Addr *addr, const void *ipv4, int port);
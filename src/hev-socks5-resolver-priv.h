@@ -0,0 +1,33 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-resolver-priv.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Resolver Private
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_RESOLVER_PRIV_H__
+#define __HEV_SOCKS5_RESOLVER_PRIV_H__
+
+#include <netinet/in.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Resolves name with A and/or AAAA queries sent in parallel over UDP from
+ * the calling task. Addresses are v4-mapped, A records first, and ttl is
+ * set to the lowest record TTL in milliseconds. Returns the number of
+ * addresses, 0 when every query was answered without one (NXDOMAIN or no
+ * records) or -1 when none was found and some query went unanswered.
+ */
+int hev_socks5_resolver_query (const char *name, int family,
+                               struct in6_addr *addrs, int nums, int *ttl);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_SOCKS5_RESOLVER_PRIV_H__ */
@@ -0,0 +1,337 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-resolver.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Resolver
+ ============================================================================
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+
+#include "hev-socks5-misc-priv.h"
+#include "hev-socks5-logger-priv.h"
+
+#include "hev-socks5-resolver-priv.h"
+
+#define RESOLVER_TYPE_A (1)
+#define RESOLVER_TYPE_AAAA (28)
+#define RESOLVER_MAX_TTL (604800)
+
+typedef struct _HevSocks5ResolverQuery HevSocks5ResolverQuery;
+
+struct _HevSocks5ResolverQuery
+{
+    int type;
+    int len;
+    int done;
+    int nums;
+    int ttl;
+
+    struct in6_addr addrs[HEV_SOCKS5_CONNECT_ADDRS];
+    uint8_t buf[288];
+};
+
+static __thread uint16_t ids[64];
+static __thread int id_nums;
+
+static int
+hev_socks5_resolver_build (HevSocks5ResolverQuery *q, const char *name,
+                           int type, int id)
+{
+    uint8_t *p = &q->buf[12];
+
+    memset (q, 0, sizeof (HevSocks5ResolverQuery));
+    q->type = type;
+    q->ttl = -1;
+
+    q->buf[0] = id >> 8;
+    q->buf[1] = id;
+    q->buf[2] = 0x01; /* recursion desired */
+    q->buf[5] = 1;
+
+    while (*name) {
+        const char *dot = strchr (name, '.');
+        int len = dot ? (int)(dot - name) : (int)strlen (name);
+
+        if (len == 0 || len > 63 || (p - &q->buf[12]) + len + 2 > 255)
+            return -1;
+
+        *p++ = len;
+        memcpy (p, name, len);
+        p += len;
+        name += len;
+        if (*name)
+            name++;
+    }
+
+    if (p == &q->buf[12])
+        return -1;
+
+    *p++ = 0;
+    *p++ = type >> 8;
+    *p++ = type;
+    *p++ = 0;
+    *p++ = 1;
+    q->len = p - q->buf;
+
+    return 0;
+}
+
+static int
+hev_socks5_resolver_id (void)
+{
+    /* query IDs are the only defence against off-path spoofing */
+    if (!id_nums) {
+        ssize_t res;
+        int fd;
+
+        fd = open ("/dev/urandom", O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return -1;
+        res = read (fd, ids, sizeof (ids));
+        close (fd);
+        if (res != sizeof (ids))
+            return -1;
+        id_nums = sizeof (ids) / sizeof (ids[0]);
+    }
+
+    return ids[--id_nums];
+}
+
+static int
+hev_socks5_resolver_skip_name (const uint8_t *buf, int len, int off)
+{
+    while (off < len) {
+        int l = buf[off];
+
+        if (l == 0)
+            return off + 1;
+        if ((l & 0xc0) == 0xc0)
+            return (off + 2 <= len) ? off + 2 : -1;
+        if (l & 0xc0)
+            return -1;
+
+        off += 1 + l;
+    }
+
+    return -1;
+}
+
+static void
+hev_socks5_resolver_parse (HevSocks5ResolverQuery *qs, int qnums,
+                           const uint8_t *buf, int len)
+{
+    HevSocks5ResolverQuery *q = NULL;
+    int an, off, i;
+
+    if (len < 12 || !(buf[2] & 0x80))
+        return;
+
+    for (i = 0; i < qnums; i++) {
+        if (!qs[i].done && qs[i].buf[0] == buf[0] && qs[i].buf[1] == buf[1])
+            q = &qs[i];
+    }
+    if (!q)
+        return;
+
+    /* the question must come back unchanged */
+    if (len < q->len || memcmp (&buf[4], &q->buf[4], 2) ||
+        memcmp (&buf[12], &q->buf[12], q->len - 12))
+        return;
+
+    /* anything but an answer or NXDOMAIN goes to the next nameserver */
+    switch (buf[3] & 0x0f) {
+    case 0:
+    case 3:
+        break;
+    default:
+        return;
+    }
+
+    an = (buf[6] << 8) | buf[7];
+    off = q->len;
+
+    for (i = 0; i < an; i++) {
+        uint32_t ttl;
+        int type;
+        int rdlen;
+
+        off = hev_socks5_resolver_skip_name (buf, len, off);
+        if (off < 0 || (off + 10) > len)
+            break;
+
+        type = (buf[off] << 8) | buf[off + 1];
+        ttl = ((uint32_t)buf[off + 4] << 24) | (buf[off + 5] << 16) |
+              (buf[off + 6] << 8) | buf[off + 7];
+        rdlen = (buf[off + 8] << 8) | buf[off + 9];
+        off += 10;
+        if ((off + rdlen) > len)
+            break;
+
+        if (type == q->type && q->nums < HEV_SOCKS5_CONNECT_ADDRS) {
+            struct in6_addr *addr = &q->addrs[q->nums];
+
+            if (type == RESOLVER_TYPE_A && rdlen == 4) {
+                memset (addr, 0, 10);
+                addr->s6_addr[10] = 0xff;
+                addr->s6_addr[11] = 0xff;
+                memcpy (&addr->s6_addr[12], &buf[off], 4);
+                q->nums++;
+            } else if (type == RESOLVER_TYPE_AAAA && rdlen == 16) {
+                memcpy (addr, &buf[off], 16);
+                q->nums++;
+            }
+
+            if (ttl > RESOLVER_MAX_TTL)
+                ttl = RESOLVER_MAX_TTL;
+            if (q->ttl < 0 || (int)ttl < q->ttl)
+                q->ttl = ttl;
+        }
+
+        off += rdlen;
+    }
+
+    q->done = 1;
+}
+
+static int
+hev_socks5_resolver_wait (HevSocks5ResolverQuery *qs, int qnums, int fd,
+                          struct sockaddr_in6 *server, int64_t deadline)
+{
+    uint8_t buf[1500];
+    int i;
+
+    for (;;) {
+        struct sockaddr_in6 from;
+        socklen_t flen = sizeof (from);
+        int64_t now;
+        ssize_t res;
+
+        for (i = 0; i < qnums; i++) {
+            if (!qs[i].done)
+                break;
+        }
+        if (i == qnums)
+            return 0;
+
+        res = recvfrom (fd, buf, sizeof (buf), 0, (struct sockaddr *)&from,
+                        &flen);
+        if (res >= 0) {
+            if (from.sin6_port != server->sin6_port ||
+                memcmp (&from.sin6_addr, &server->sin6_addr, 16))
+                continue;
+
+            hev_socks5_resolver_parse (qs, qnums, buf, res);
+            continue;
+        }
+
+        if (errno != EAGAIN)
+            return -1;
+
+        now = hev_socks5_now ();
+        if (now >= deadline)
+            return -1;
+
+        hev_task_sleep (deadline - now);
+    }
+}
+
+int
+hev_socks5_resolver_query (const char *name, int family,
+                           struct in6_addr *addrs, int nums, int *ttl)
+{
+    struct sockaddr_in6 servers[HEV_SOCKS5_DNS_NAMESERVERS];
+    HevSocks5ResolverQuery qs[2];
+    int snums, qnums = 0;
+    int timeout, tries;
+    int i, n, fd, id;
+
+    snums = hev_socks5_get_dns_nameservers (servers);
+    if (!snums) {
+        LOG_W ("socks5 resolver no nameservers");
+        return -1;
+    }
+
+    for (i = 0; i < 2; i++) {
+        int type = i ? RESOLVER_TYPE_AAAA : RESOLVER_TYPE_A;
+
+        if (family == (i ? HEV_SOCKS5_ADDR_FAMILY_IPV4
+                         : HEV_SOCKS5_ADDR_FAMILY_IPV6))
+            continue;
+
+        id = hev_socks5_resolver_id ();
+        if (id < 0) {
+            LOG_E ("socks5 resolver random");
+            return -1;
+        }
+
+        n = hev_socks5_resolver_build (&qs[qnums], name, type, id);
+        if (n < 0)
+            return 0;
+        qnums++;
+    }
+
+    fd = hev_socks5_socket (SOCK_DGRAM);
+    if (fd < 0) {
+        LOG_E ("socks5 resolver socket");
+        return -1;
+    }
+
+    timeout = hev_socks5_get_dns_timeout ();
+    tries = hev_socks5_get_dns_attempts () * snums;
+
+    /* each try sends every unanswered query to the next nameserver */
+    for (i = 0; i < tries; i++) {
+        struct sockaddr_in6 *server = &servers[i % snums];
+        int j;
+
+        for (j = 0; j < qnums; j++) {
+            if (qs[j].done)
+                continue;
+            sendto (fd, qs[j].buf, qs[j].len, 0, (struct sockaddr *)server,
+                    sizeof (struct sockaddr_in6));
+        }
+
+        n = hev_socks5_resolver_wait (qs, qnums, fd, server,
+                                      hev_socks5_now () + timeout);
+        if (n == 0)
+            break;
+    }
+
+    hev_task_del_fd (hev_task_self (), fd);
+    close (fd);
+
+    *ttl = -1;
+    for (i = 0, n = 0; i < qnums; i++) {
+        HevSocks5ResolverQuery *q = &qs[i];
+        int j;
+
+        if (!q->done)
+            continue;
+
+        for (j = 0; j < q->nums && n < nums; j++)
+            addrs[n++] = q->addrs[j];
+
+        if (q->ttl >= 0 && (*ttl < 0 || (q->ttl * 1000) < *ttl))
+            *ttl = q->ttl * 1000;
+    }
+
+    /* an empty answer only counts once every query was answered */
+    for (i = 0; i < qnums; i++) {
+        if (!qs[i].done)
+            break;
+    }
+    if (n > 0 || i == qnums)
+        return n;
+
+    LOG_I ("socks5 resolver %s timeout", name);
+    return -1;
+}
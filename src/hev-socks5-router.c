@@ -0,0 +1,290 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-router.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Router
+ ============================================================================
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-socks5-misc-priv.h"
+#include "hev-socks5-logger-priv.h"
+
+#include "hev-socks5-router.h"
+
+HevSocks5Router *
+hev_socks5_router_new (void)
+{
+    HevSocks5Router *self;
+    int res;
+
+    self = hev_malloc0 (sizeof (HevSocks5Router));
+    if (!self)
+        return NULL;
+
+    res = hev_socks5_router_construct (self);
+    if (res < 0) {
+        hev_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p socks5 router new", self);
+
+    return self;
+}
+
+static int
+hev_socks5_router_parse (HevSocks5RouterRule *rule, const char *dest)
+{
+    const char *slash;
+    char buf[64];
+    int max = 128;
+    int len;
+
+    rule->prefix = -1;
+    if (!dest)
+        return 0;
+
+    slash = strchr (dest, '/');
+    len = slash ? (int)(slash - dest) : (int)strlen (dest);
+    if (len < (int)sizeof (buf)) {
+        memcpy (buf, dest, len);
+        buf[len] = '\0';
+
+        if (inet_pton (AF_INET, buf, &rule->addr.s6_addr[12]) == 1) {
+            memset (&rule->addr, 0, 10);
+            rule->addr.s6_addr[10] = 0xff;
+            rule->addr.s6_addr[11] = 0xff;
+            rule->prefix = 96;
+            max = 32;
+        } else if (inet_pton (AF_INET6, buf, &rule->addr) == 1) {
+            rule->prefix = 0;
+        }
+    }
+
+    if (rule->prefix < 0) {
+        if (slash)
+            return -1;
+        rule->name = hev_socks5_strdup (dest);
+        return rule->name ? 0 : -1;
+    }
+
+    len = slash ? atoi (slash + 1) : max;
+    if (len < 0 || len > max)
+        return -1;
+    rule->prefix += len;
+
+    return 0;
+}
+
+int
+hev_socks5_router_add (HevSocks5Router *self, const char *user,
+                       const char *dest, int port, HevSocks5ClientPool *parent)
+{
+    HevSocks5RouterRule *rules;
+    HevSocks5RouterRule *rule;
+    size_t size;
+
+    LOG_D ("%p socks5 router add %s %s:%d", self, user ? user : "*",
+           dest ? dest : "*", port);
+
+    size = sizeof (HevSocks5RouterRule) * (self->nums + 1);
+    rules = hev_realloc (self->rules, size);
+    if (!rules)
+        return -1;
+    self->rules = rules;
+
+    rule = &rules[self->nums];
+    memset (rule, 0, sizeof (HevSocks5RouterRule));
+
+    if (hev_socks5_router_parse (rule, dest) < 0)
+        return -1;
+
+    if (user) {
+        rule->user = hev_socks5_strdup (user);
+        if (!rule->user) {
+            if (rule->name)
+                hev_free (rule->name);
+            return -1;
+        }
+    }
+
+    if (parent)
+        hev_object_ref (HEV_OBJECT (parent));
+
+    rule->port = port;
+    rule->parent = parent;
+    self->nums++;
+
+    return 0;
+}
+
+static int
+hev_socks5_router_match_name (HevSocks5RouterRule *rule,
+                              const HevSocks5Addr *addr)
+{
+    const char *name = (const char *)addr->domain.addr;
+    int nlen = addr->domain.len;
+    int slen = strlen (rule->name);
+
+    if (nlen < slen)
+        return 0;
+
+    /* the name itself, or one of its subdomains */
+    if (nlen > slen && name[nlen - slen - 1] != '.')
+        return 0;
+
+    return strncasecmp (&name[nlen - slen], rule->name, slen) == 0;
+}
+
+static int
+hev_socks5_router_match_addr (HevSocks5RouterRule *rule,
+                              const HevSocks5Addr *addr)
+{
+    struct in6_addr in;
+    int bytes, bits;
+
+    if (addr->atype == HEV_SOCKS5_ADDR_TYPE_IPV4) {
+        memset (&in, 0, 10);
+        in.s6_addr[10] = 0xff;
+        in.s6_addr[11] = 0xff;
+        memcpy (&in.s6_addr[12], addr->ipv4.addr, 4);
+    } else {
+        memcpy (&in, addr->ipv6.addr, 16);
+    }
+
+    bytes = rule->prefix / 8;
+    bits = rule->prefix % 8;
+
+    if (memcmp (&in, &rule->addr, bytes))
+        return 0;
+
+    if (bits) {
+        int mask = 0xff << (8 - bits);
+
+        if ((in.s6_addr[bytes] ^ rule->addr.s6_addr[bytes]) & mask)
+            return 0;
+    }
+
+    return 1;
+}
+
+static int
+hev_socks5_router_match_rule (HevSocks5RouterRule *rule, HevSocks5User *user,
+                              const HevSocks5Addr *addr)
+{
+    uint16_t port;
+
+    if (rule->user) {
+        if (!user || strlen (rule->user) != user->name_len ||
+            memcmp (rule->user, user->name, user->name_len))
+            return 0;
+    }
+
+    switch (addr->atype) {
+    case HEV_SOCKS5_ADDR_TYPE_IPV4:
+        port = addr->ipv4.port;
+        if (rule->name || (rule->prefix >= 0 &&
+                           !hev_socks5_router_match_addr (rule, addr)))
+            return 0;
+        break;
+    case HEV_SOCKS5_ADDR_TYPE_IPV6:
+        port = addr->ipv6.port;
+        if (rule->name || (rule->prefix >= 0 &&
+                           !hev_socks5_router_match_addr (rule, addr)))
+            return 0;
+        break;
+    case HEV_SOCKS5_ADDR_TYPE_NAME:
+        memcpy (&port, &addr->domain.addr[addr->domain.len], 2);
+        if (rule->prefix >= 0 ||
+            (rule->name && !hev_socks5_router_match_name (rule, addr)))
+            return 0;
+        break;
+    default:
+        return 0;
+    }
+
+    return !rule->port || rule->port == ntohs (port);
+}
+
+HevSocks5ClientPool *
+hev_socks5_router_match (HevSocks5Router *self, HevSocks5User *user,
+                         const HevSocks5Addr *addr)
+{
+    int i;
+
+    for (i = 0; i < self->nums; i++) {
+        HevSocks5RouterRule *rule = &self->rules[i];
+
+        if (hev_socks5_router_match_rule (rule, user, addr))
+            return rule->parent;
+    }
+
+    return NULL;
+}
+
+int
+hev_socks5_router_construct (HevSocks5Router *self)
+{
+    int res;
+
+    res = hev_object_construct (&self->base);
+    if (res < 0)
+        return res;
+
+    LOG_D ("%p socks5 router construct", self);
+
+    HEV_OBJECT (self)->klass = HEV_SOCKS5_ROUTER_TYPE;
+
+    return 0;
+}
+
+static void
+hev_socks5_router_destruct (HevObject *base)
+{
+    HevSocks5Router *self = HEV_SOCKS5_ROUTER (base);
+    int i;
+
+    LOG_D ("%p socks5 router destruct", self);
+
+    for (i = 0; i < self->nums; i++) {
+        HevSocks5RouterRule *rule = &self->rules[i];
+
+        if (rule->user)
+            hev_free (rule->user);
+        if (rule->name)
+            hev_free (rule->name);
+        if (rule->parent)
+            hev_object_unref (HEV_OBJECT (rule->parent));
+    }
+
+    if (self->rules)
+        hev_free (self->rules);
+
+    HEV_OBJECT_TYPE->destruct (base);
+    hev_free (base);
+}
+
+HevObjectClass *
+hev_socks5_router_class (void)
+{
+    static HevSocks5RouterClass klass;
+    HevSocks5RouterClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        memcpy (kptr, HEV_OBJECT_TYPE, sizeof (HevObjectClass));
+
+        okptr->name = "HevSocks5Router";
+        okptr->destruct = hev_socks5_router_destruct;
+    }
+
+    return okptr;
+}
@@ -0,0 +1,88 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-router.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Router
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_ROUTER_H__
+#define __HEV_SOCKS5_ROUTER_H__
+
+#include <netinet/in.h>
+
+#include <hev-object.h>
+
+#include "hev-socks5-proto.h"
+#include "hev-socks5-user.h"
+#include "hev-socks5-client-pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_SOCKS5_ROUTER(p) ((HevSocks5Router *)p)
+#define HEV_SOCKS5_ROUTER_CLASS(p) ((HevSocks5RouterClass *)p)
+#define HEV_SOCKS5_ROUTER_TYPE (hev_socks5_router_class ())
+
+typedef struct _HevSocks5Router HevSocks5Router;
+typedef struct _HevSocks5RouterRule HevSocks5RouterRule;
+typedef struct _HevSocks5RouterClass HevSocks5RouterClass;
+
+struct _HevSocks5RouterRule
+{
+    char *user;
+    char *name;
+    int port;
+    int prefix; /* -1: any address */
+
+    struct in6_addr addr;
+
+    HevSocks5ClientPool *parent;
+};
+
+/*
+ * Ordered rules that send server sessions through parent socks5 proxies.
+ * The first rule matching the user and destination of a session decides,
+ * and a rule without a parent keeps its sessions direct. A router is owned
+ * by the task system of the thread that created it, like its pools.
+ */
+struct _HevSocks5Router
+{
+    HevObject base;
+
+    int nums;
+
+    HevSocks5RouterRule *rules;
+};
+
+struct _HevSocks5RouterClass
+{
+    HevObjectClass base;
+};
+
+HevObjectClass *hev_socks5_router_class (void);
+
+int hev_socks5_router_construct (HevSocks5Router *self);
+
+HevSocks5Router *hev_socks5_router_new (void);
+
+/*
+ * Appends a rule. A NULL user matches every user, and port 0 every port.
+ * The destination is NULL for any, an address with an optional prefix
+ * length such as "10.0.0.0/8", or a name that also matches its subdomains.
+ */
+int hev_socks5_router_add (HevSocks5Router *self, const char *user,
+                           const char *dest, int port,
+                           HevSocks5ClientPool *parent);
+
+HevSocks5ClientPool *hev_socks5_router_match (HevSocks5Router *self,
+                                              HevSocks5User *user,
+                                              const HevSocks5Addr *addr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_SOCKS5_ROUTER_H__ */
@@ -2,11 +2,12 @@
  ============================================================================
  Name        : hev-socks5-server.c
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2021 - 2025 hev
+ Copyright   : Copyright (c) 2021 - 2026 hev
  Description : Socks5 Server
  ============================================================================
  */
 
+#include <errno.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -18,11 +19,59 @@
 #include "hev-socks5-proto.h"
 #include "hev-socks5-misc-priv.h"
 #include "hev-socks5-logger-priv.h"
+#include "hev-socks5-breaker-priv.h"
+#include "hev-socks5-admission-priv.h"
+
+#include "hev-socks5-client-tcp.h"
+#include "hev-socks5-client-udp.h"
 
 #include "hev-socks5-server.h"
 
+/* greeting (2 + 255), auth (3 + 255 + 255) and request (4 + 1 + 255 + 2) */
+#define HANDSHAKE_BUF_SIZE 1040
+
 #define task_io_yielder hev_socks5_task_io_yielder
 
+typedef struct _HevSocks5ServerSpec HevSocks5ServerSpec;
+typedef struct _HevSocks5ServerReader HevSocks5ServerReader;
+
+struct _HevSocks5ServerSpec
+{
+    int fd;
+    int nums;
+    int done;
+    int connect;
+    int connecting;
+    int cancelled;
+    int timeout;
+
+    HevTask *task;
+    HevTask *waiter;
+    HevSocks5Server *server;
+
+    HevSocks5Addr addr;
+    struct sockaddr_in6 key;
+    struct sockaddr_in6 saddr;
+    struct sockaddr_in6 saddrs[HEV_SOCKS5_CONNECT_ADDRS];
+};
+
+struct _HevSocks5ServerReader
+{
+    int off;
+    int len;
+    int olen;
+    int seen;
+    int port;
+    int64_t start;
+    HevSocks5HandshakePhase phase;
+    uint8_t out[4];
+    uint8_t buf[HANDSHAKE_BUF_SIZE];
+
+    HevSocks5ServerSpec *spec;
+
+    struct sockaddr_in6 saddrs[HEV_SOCKS5_CONNECT_ADDRS];
+};
+
 HevSocks5Server *
 hev_socks5_server_new (int fd)
 {
@@ -54,44 +103,153 @@ hev_socks5_server_set_auth (HevSocks5Server *self, HevSocks5Authenticator *auth)
     self->auth = auth;
 }
 
+void
+hev_socks5_server_set_router (HevSocks5Server *self, HevSocks5Router *router)
+{
+    if (self->router)
+        hev_object_unref (HEV_OBJECT (self->router));
+
+    hev_object_ref (HEV_OBJECT (router));
+    self->router = router;
+}
+
 static int
-hev_socks5_server_read_auth_method (HevSocks5Server *self)
+hev_socks5_server_pace (HevSocks5Server *self, HevSocks5ServerReader *rd)
+{
+    int deadline = hev_socks5_get_handshake_timeout ();
+    int rate = hev_socks5_get_handshake_min_rate ();
+    int timeout;
+    int64_t elapsed;
+    int64_t wait;
+
+    if (!deadline && !rate)
+        return 0;
+
+    timeout = hev_socks5_get_tcp_timeout ();
+    elapsed = hev_socks5_now () - rd->start;
+
+    /* the next wait ends when either limit would be broken */
+    if (deadline) {
+        wait = deadline - elapsed;
+        if (wait <= 0)
+            return -1;
+        if (timeout < 0 || wait < timeout)
+            timeout = wait;
+    }
+
+    if (rate) {
+        wait = (int64_t)rd->seen * 1000 / rate;
+        if (wait < 1000)
+            wait = 1000;
+        wait -= elapsed;
+        if (wait <= 0)
+            return -1;
+        if (timeout < 0 || wait < timeout)
+            timeout = wait;
+    }
+
+    hev_socks5_set_timeout (HEV_SOCKS5 (self), timeout);
+
+    return 0;
+}
+
+static int
+hev_socks5_server_fill (HevSocks5Server *self, HevSocks5ServerReader *rd,
+                        int need)
+{
+    int fd = HEV_SOCKS5 (self)->fd;
+
+    /*
+     * Handshake bytes are peeked, not read, so that nothing the client
+     * pipelines after the request is taken from the socket by accident.
+     */
+    while (rd->len < (rd->off + need)) {
+        ssize_t res;
+
+        res = recv (fd, rd->buf, sizeof (rd->buf), MSG_PEEK);
+        if (res == 0)
+            return -1;
+        if (res < 0 && errno != EAGAIN)
+            return -1;
+
+        if (res > rd->len) {
+            rd->seen += res - rd->len;
+            rd->len = res;
+            continue;
+        }
+
+        if (hev_socks5_server_pace (self, rd) < 0 ||
+            task_io_yielder (HEV_TASK_WAITIO, self) < 0) {
+            LOG_I ("%p socks5 server handshake timeout", self);
+            hev_socks5_handshake_account (rd->phase);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int
+hev_socks5_server_consume (HevSocks5Server *self, HevSocks5ServerReader *rd)
+{
+    ssize_t res;
+
+    if (!rd->off)
+        return 0;
+
+    /* the parsed bytes are already queued, one read takes them all */
+    res = recv (HEV_SOCKS5 (self)->fd, rd->buf, rd->off, 0);
+    if (res != rd->off)
+        return -1;
+
+    /* keep what was peeked past them, it may go out with the connect */
+    rd->len -= rd->off;
+    memmove (rd->buf, &rd->buf[rd->off], rd->len);
+    rd->off = 0;
+
+    return 0;
+}
+
+static int
+hev_socks5_server_read_auth_method (HevSocks5Server *self,
+                                    HevSocks5ServerReader *rd)
 {
-    HevSocks5Auth auth;
     HevSocks5AuthMethod method;
+    uint8_t *head;
     int res;
     int i;
 
     LOG_D ("%p socks5 server read auth method", self);
 
-    res = hev_task_io_socket_recv (HEV_SOCKS5 (self)->fd, &auth, 2, MSG_WAITALL,
-                                   task_io_yielder, self);
-    if (res != 2) {
+    res = hev_socks5_server_fill (self, rd, 2);
+    if (res < 0) {
         LOG_I ("%p socks5 server read auth method", self);
         return -1;
     }
 
-    if (auth.ver != HEV_SOCKS5_VERSION_5) {
-        LOG_I ("%p socks5 server auth.ver %u", self, auth.ver);
+    head = &rd->buf[rd->off];
+    if (head[0] != HEV_SOCKS5_VERSION_5) {
+        LOG_I ("%p socks5 server auth.ver %u", self, head[0]);
         return -1;
     }
 
-    res = hev_task_io_socket_recv (HEV_SOCKS5 (self)->fd, &auth.methods,
-                                   auth.method_len, MSG_WAITALL,
-                                   task_io_yielder, self);
-    if (res != auth.method_len) {
+    res = hev_socks5_server_fill (self, rd, 2 + head[1]);
+    if (res < 0) {
         LOG_I ("%p socks5 server read auth methods", self);
         return -1;
     }
 
+    head = &rd->buf[rd->off];
+    rd->off += 2 + head[1];
+
     if (self->auth)
         method = HEV_SOCKS5_AUTH_METHOD_USER;
     else
         method = HEV_SOCKS5_AUTH_METHOD_NONE;
 
     res = -1;
-    for (i = 0; i < auth.method_len; i++) {
-        if (auth.methods[i] == method) {
+    for (i = 0; i < head[1]; i++) {
+        if (head[2 + i] == method) {
             res = method;
             break;
         }
@@ -101,7 +259,44 @@ hev_socks5_server_read_auth_method (HevSocks5Server *self)
 }
 
 static int
-hev_socks5_server_write_auth_method (HevSocks5Server *self, int auth_method)
+hev_socks5_server_write (HevSocks5Server *self, HevSocks5ServerReader *rd,
+                         const void *buf, int len, int last)
+{
+    struct msghdr mh = { 0 };
+    struct iovec iov[2];
+    int res;
+
+    /*
+     * While the client has already pipelined the next stage, early replies
+     * are held back and leave together with the final one.
+     */
+    if (!last && rd->len > rd->off &&
+        (rd->olen + len) <= (int)sizeof (rd->out)) {
+        memcpy (&rd->out[rd->olen], buf, len);
+        rd->olen += len;
+        return 0;
+    }
+
+    iov[0].iov_base = rd->out;
+    iov[0].iov_len = rd->olen;
+    iov[1].iov_base = (void *)buf;
+    iov[1].iov_len = len;
+
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 2;
+    res = hev_task_io_socket_sendmsg (HEV_SOCKS5 (self)->fd, &mh, MSG_WAITALL,
+                                      task_io_yielder, self);
+    rd->olen = 0;
+    if (res <= 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+hev_socks5_server_write_auth_method (HevSocks5Server *self,
+                                     HevSocks5ServerReader *rd,
+                                     int auth_method)
 {
     HevSocks5Auth auth;
     int res;
@@ -111,9 +306,8 @@ hev_socks5_server_write_auth_method (HevSocks5Server *self, int auth_method)
     auth.ver = HEV_SOCKS5_VERSION_5;
     auth.method = auth_method;
 
-    res = hev_task_io_socket_send (HEV_SOCKS5 (self)->fd, &auth, 2, MSG_WAITALL,
-                                   task_io_yielder, self);
-    if (res <= 0) {
+    res = hev_socks5_server_write (self, rd, &auth, 2, auth_method < 0);
+    if (res < 0) {
         LOG_I ("%p socks5 server write auth method", self);
         return -1;
     }
@@ -121,25 +315,182 @@ hev_socks5_server_write_auth_method (HevSocks5Server *self, int auth_method)
     return 0;
 }
 
+static void
+hev_socks5_server_spec_entry (void *data)
+{
+    HevSocks5ServerSpec *spec = data;
+    HevSocks5 *base = HEV_SOCKS5 (spec->server);
+    int family;
+
+    LOG_D ("%p socks5 server speculate", spec->server);
+
+    family = hev_socks5_get_addr_family (base);
+    spec->nums = hev_socks5_addr_into_sockaddr6v (
+        &spec->addr, spec->saddrs, HEV_SOCKS5_CONNECT_ADDRS, &family);
+
+    hev_socks5_breaker_key (&spec->addr, &spec->key);
+    if (spec->nums > 0 && spec->connect && !spec->cancelled &&
+        hev_socks5_breaker_enter (&spec->key) == 0) {
+        spec->connecting = 1;
+        spec->fd = hev_socks5_connect_resolved (base, &spec->timeout,
+                                                &spec->addr, spec->saddrs,
+                                                spec->nums, &spec->saddr, NULL);
+        spec->connecting = 0;
+        if (spec->fd >= 0)
+            hev_socks5_breaker_leave (&spec->key, &spec->saddr, NULL, 0);
+        else if (spec->cancelled)
+            hev_socks5_breaker_cancel (&spec->key);
+        else
+            hev_socks5_breaker_leave (&spec->key, NULL, spec->saddrs,
+                                      spec->nums);
+        if (spec->fd >= 0)
+            hev_task_del_fd (hev_task_self (), spec->fd);
+    }
+
+    spec->done = 1;
+    if (spec->waiter)
+        hev_task_wakeup (spec->waiter);
+}
+
+static void
+hev_socks5_server_speculate (HevSocks5Server *self, HevSocks5ServerReader *rd)
+{
+    uint8_t *req = &rd->buf[rd->off];
+    int len = rd->len - rd->off;
+    HevSocks5ServerSpec *spec;
+    int speculative;
+    int addrlen;
+
+    /* a routed session may not connect directly at all */
+    speculative = hev_socks5_get_connect_speculative ();
+    if (!speculative || rd->spec || len < 5 || self->router)
+        return;
+
+    if (req[0] != HEV_SOCKS5_VERSION_5 || req[1] != HEV_SOCKS5_REQ_CMD_CONNECT)
+        return;
+
+    switch (req[3]) {
+    case HEV_SOCKS5_ADDR_TYPE_IPV4:
+        addrlen = 5;
+        break;
+    case HEV_SOCKS5_ADDR_TYPE_IPV6:
+        addrlen = 17;
+        break;
+    case HEV_SOCKS5_ADDR_TYPE_NAME:
+        addrlen = 2 + req[4];
+        break;
+    default:
+        return;
+    }
+
+    if (len < (5 + addrlen))
+        return;
+
+    spec = hev_malloc0 (sizeof (HevSocks5ServerSpec));
+    if (!spec)
+        return;
+
+    spec->task = hev_task_new (hev_socks5_get_task_stack_size ());
+    if (!spec->task) {
+        hev_free (spec);
+        return;
+    }
+
+    spec->fd = -1;
+    rd->spec = spec;
+    memcpy (&spec->addr, &req[3], 2 + addrlen);
+    spec->connect = speculative > 1;
+    spec->server = self;
+
+    /* the spec races on its own budget, the session keeps its timeout */
+    spec->timeout = hev_socks5_get_connect_timeout ();
+
+    hev_task_run (spec->task, hev_socks5_server_spec_entry, spec);
+}
+
 static int
-hev_socks5_server_read_auth_user (HevSocks5Server *self)
+hev_socks5_server_spec_join (HevSocks5Server *self, HevSocks5ServerSpec *spec,
+                             const HevSocks5Addr *raddr,
+                             struct sockaddr_in6 *saddrs)
+{
+    int len;
+
+    if (!spec || !spec->task)
+        return 0;
+
+    spec->waiter = hev_task_self ();
+    while (!spec->done)
+        hev_task_yield (HEV_TASK_WAITIO);
+    spec->waiter = NULL;
+    spec->task = NULL;
+
+    /* what was worked out for another target does not apply */
+    len = hev_socks5_addr_len (raddr);
+    if (memcmp (&spec->addr, raddr, len) != 0) {
+        if (spec->fd >= 0)
+            close (spec->fd);
+        spec->fd = -1;
+        spec->connect = 0;
+        return 0;
+    }
+
+    if (spec->nums <= 0)
+        return -1;
+
+    memcpy (saddrs, spec->saddrs, sizeof (struct sockaddr_in6) * spec->nums);
+    return spec->nums;
+}
+
+static void
+hev_socks5_server_spec_cancel (HevSocks5Server *self,
+                               HevSocks5ServerReader *rd)
+{
+    HevSocks5ServerSpec *spec = rd->spec;
+
+    if (!spec)
+        return;
+
+    /* the session is over, so abort a connect still in flight */
+    if (spec->task) {
+        spec->cancelled = 1;
+        if (spec->connecting) {
+            spec->timeout = 0;
+            hev_task_wakeup (spec->task);
+        }
+
+        spec->waiter = hev_task_self ();
+        while (!spec->done)
+            hev_task_yield (HEV_TASK_WAITIO);
+        spec->waiter = NULL;
+    }
+
+    if (spec->fd >= 0)
+        close (spec->fd);
+
+    hev_free (spec);
+    rd->spec = NULL;
+}
+
+static int
+hev_socks5_server_read_auth_user (HevSocks5Server *self,
+                                  HevSocks5ServerReader *rd)
 {
     HevSocks5User *user;
     uint8_t nlen, plen;
-    uint8_t name[257];
-    uint8_t pass[257];
-    uint8_t head[2];
+    uint8_t *name;
+    uint8_t *pass;
+    uint8_t *head;
     int res;
 
     LOG_D ("%p socks5 server read auth user", self);
 
-    res = hev_task_io_socket_recv (HEV_SOCKS5 (self)->fd, head, 2, MSG_WAITALL,
-                                   task_io_yielder, self);
-    if (res != 2) {
+    res = hev_socks5_server_fill (self, rd, 2);
+    if (res < 0) {
         LOG_I ("%p socks5 server read auth user.ver", self);
         return -1;
     }
 
+    head = &rd->buf[rd->off];
     if (head[0] != 1) {
         LOG_I ("%p socks5 server auth user.ver %u", self, head[0]);
         return -1;
@@ -151,38 +502,43 @@ hev_socks5_server_read_auth_user (HevSocks5Server *self)
         return -1;
     }
 
-    res = hev_task_io_socket_recv (HEV_SOCKS5 (self)->fd, name, nlen + 1,
-                                   MSG_WAITALL, task_io_yielder, self);
-    if (res != (nlen + 1)) {
+    res = hev_socks5_server_fill (self, rd, 3 + nlen);
+    if (res < 0) {
         LOG_I ("%p socks5 server read auth user.name", self);
         return -1;
     }
 
-    plen = name[nlen];
+    head = &rd->buf[rd->off];
+    plen = head[2 + nlen];
     if (plen == 0) {
         LOG_I ("%p socks5 server auth user.plen %u", self, plen);
         return -1;
     }
 
-    res = hev_task_io_socket_recv (HEV_SOCKS5 (self)->fd, pass, plen,
-                                   MSG_WAITALL, task_io_yielder, self);
-    if (res != plen) {
+    res = hev_socks5_server_fill (self, rd, 3 + nlen + plen);
+    if (res < 0) {
         LOG_I ("%p socks5 server read auth user.pass", self);
         return -1;
     }
 
+    head = &rd->buf[rd->off];
+    name = &head[2];
+    pass = &head[3 + nlen];
+    rd->off += 3 + nlen + plen;
+
     user = hev_socks5_authenticator_get (self->auth, (char *)name, nlen);
     if (!user) {
-        name[nlen] = '\0';
-        LOG_I ("%p socks5 server auth user: %s", self, name);
+        LOG_I ("%p socks5 server auth user: %.*s", self, nlen, name);
         return -1;
     }
 
+    /* unknown users never get to touch the target */
+    hev_socks5_server_speculate (self, rd);
+
     res = hev_socks5_user_check (user, (char *)pass, plen);
     if (res < 0) {
-        name[nlen] = '\0';
-        pass[plen] = '\0';
-        LOG_I ("%p socks5 server auth user: %s pass: %s", self, name, pass);
+        LOG_I ("%p socks5 server auth user: %.*s pass: %.*s", self, nlen,
+               name, plen, pass);
         return -1;
     }
 
@@ -194,7 +550,8 @@ hev_socks5_server_read_auth_user (HevSocks5Server *self)
 }
 
 static int
-hev_socks5_server_write_auth_user (HevSocks5Server *self, int auth_res)
+hev_socks5_server_write_auth_user (HevSocks5Server *self,
+                                   HevSocks5ServerReader *rd, int auth_res)
 {
     uint8_t buf[2];
     int res;
@@ -204,9 +561,8 @@ hev_socks5_server_write_auth_user (HevSocks5Server *self, int auth_res)
     buf[0] = 1;
     buf[1] = auth_res;
 
-    res = hev_task_io_socket_send (HEV_SOCKS5 (self)->fd, buf, 2, MSG_WAITALL,
-                                   task_io_yielder, self);
-    if (res <= 0) {
+    res = hev_socks5_server_write (self, rd, buf, 2, auth_res != 0);
+    if (res < 0) {
         LOG_I ("%p socks5 server write auth user", self);
         return -1;
     }
@@ -215,13 +571,13 @@ hev_socks5_server_write_auth_user (HevSocks5Server *self, int auth_res)
 }
 
 static int
-hev_socks5_server_auth (HevSocks5Server *self)
+hev_socks5_server_auth (HevSocks5Server *self, HevSocks5ServerReader *rd)
 {
     int method;
     int res;
 
-    method = hev_socks5_server_read_auth_method (self);
-    res = hev_socks5_server_write_auth_method (self, method);
+    method = hev_socks5_server_read_auth_method (self, rd);
+    res = hev_socks5_server_write_auth_method (self, rd, method);
     if (res < 0)
         return -1;
 
@@ -229,8 +585,9 @@ hev_socks5_server_auth (HevSocks5Server *self)
     case HEV_SOCKS5_AUTH_METHOD_NONE:
         break;
     case HEV_SOCKS5_AUTH_METHOD_USER:
-        res = hev_socks5_server_read_auth_user (self);
-        res |= hev_socks5_server_write_auth_user (self, res);
+        rd->phase = HEV_SOCKS5_HANDSHAKE_AUTH;
+        res = hev_socks5_server_read_auth_user (self, rd);
+        res |= hev_socks5_server_write_auth_user (self, rd, res);
         if (res < 0)
             return -1;
         break;
@@ -242,8 +599,9 @@ hev_socks5_server_auth (HevSocks5Server *self)
 }
 
 static int
-hev_socks5_server_read_request (HevSocks5Server *self, int *cmd, int *rep,
-                                struct sockaddr_in6 *addr)
+hev_socks5_server_read_request (HevSocks5Server *self,
+                                HevSocks5ServerReader *rd, int *cmd, int *rep,
+                                HevSocks5Addr *raddr, struct sockaddr_in6 *addr)
 {
     HevSocks5ReqRes req;
     int addr_family;
@@ -252,13 +610,15 @@ hev_socks5_server_read_request (HevSocks5Server *self, int *cmd, int *rep,
 
     LOG_D ("%p socks5 server read request", self);
 
-    res = hev_task_io_socket_recv (HEV_SOCKS5 (self)->fd, &req, 5, MSG_WAITALL,
-                                   task_io_yielder, self);
-    if (res != 5) {
+    res = hev_socks5_server_fill (self, rd, 5);
+    if (res < 0) {
         LOG_I ("%p socks5 server read request", self);
         return -1;
     }
 
+    memcpy (&req, &rd->buf[rd->off], 5);
+    rd->off += 5;
+
     if (req.ver != HEV_SOCKS5_VERSION_5) {
         *rep = HEV_SOCKS5_RES_REP_FAIL;
         LOG_I ("%p socks5 server req.ver %u", self, req.ver);
@@ -281,22 +641,21 @@ hev_socks5_server_read_request (HevSocks5Server *self, int *cmd, int *rep,
         return 0;
     }
 
-    res = hev_task_io_socket_recv (HEV_SOCKS5 (self)->fd, req.addr.domain.addr,
-                                   addrlen, MSG_WAITALL, task_io_yielder, self);
-    if (res != addrlen) {
+    res = hev_socks5_server_fill (self, rd, addrlen);
+    if (res < 0) {
         *rep = HEV_SOCKS5_RES_REP_ADDR;
         LOG_I ("%p socks5 server read addr", self);
         return 0;
     }
 
-    addr_family = hev_socks5_get_addr_family (HEV_SOCKS5 (self));
-    res = hev_socks5_addr_into_sockaddr6 (&req.addr, addr, &addr_family);
+    memcpy (req.addr.domain.addr, &rd->buf[rd->off], addrlen);
+    rd->off += addrlen;
+
+    res = hev_socks5_server_consume (self, rd);
     if (res < 0) {
-        *rep = HEV_SOCKS5_RES_REP_ADDR;
-        LOG_I ("%p socks5 server resolve addr", self);
-        return 0;
+        LOG_I ("%p socks5 server read request", self);
+        return -1;
     }
-    hev_socks5_set_addr_family (HEV_SOCKS5 (self), addr_family);
 
     if (LOG_ON ()) {
         const char *type;
@@ -321,12 +680,27 @@ hev_socks5_server_read_request (HevSocks5Server *self, int *cmd, int *rep,
     }
 
     *cmd = req.cmd;
+    memcpy (raddr, &req.addr, 1 + addrlen);
+
+    /* connect resolves all addresses itself to race them */
+    if (req.cmd == HEV_SOCKS5_REQ_CMD_CONNECT)
+        return 0;
+
+    addr_family = hev_socks5_get_addr_family (HEV_SOCKS5 (self));
+    res = hev_socks5_addr_into_sockaddr6 (&req.addr, addr, &addr_family);
+    if (res < 0) {
+        *rep = HEV_SOCKS5_RES_REP_ADDR;
+        LOG_I ("%p socks5 server resolve addr", self);
+        return 0;
+    }
+    hev_socks5_set_addr_family (HEV_SOCKS5 (self), addr_family);
 
     return 0;
 }
 
 static int
-hev_socks5_server_write_response (HevSocks5Server *self, int rep,
+hev_socks5_server_write_response (HevSocks5Server *self,
+                                  HevSocks5ServerReader *rd, int rep,
                                   struct sockaddr_in6 *addr)
 {
     HevSocks5ReqRes res;
@@ -339,9 +713,8 @@ hev_socks5_server_write_response (HevSocks5Server *self, int rep,
     res.rsv = 0;
 
     ret = hev_socks5_addr_from_sockaddr6 (&res.addr, addr);
-    ret = hev_task_io_socket_send (HEV_SOCKS5 (self)->fd, &res, 3 + ret,
-                                   MSG_WAITALL, task_io_yielder, self);
-    if (ret <= 0) {
+    ret = hev_socks5_server_write (self, rd, &res, 3 + ret, 1);
+    if (ret < 0) {
         LOG_I ("%p socks5 server write response", self);
         return -1;
     }
@@ -350,46 +723,233 @@ hev_socks5_server_write_response (HevSocks5Server *self, int rep,
 }
 
 static int
-hev_socks5_server_connect (HevSocks5Server *self, struct sockaddr_in6 *addr)
+hev_socks5_server_resolve (HevSocks5Server *self, const HevSocks5Addr *raddr,
+                           struct sockaddr_in6 *saddrs)
+{
+    int family;
+    int nums;
+
+    LOG_D ("%p socks5 server resolve", self);
+
+    family = hev_socks5_get_addr_family (HEV_SOCKS5 (self));
+    nums = hev_socks5_addr_into_sockaddr6v (raddr, saddrs,
+                                            HEV_SOCKS5_CONNECT_ADDRS, &family);
+    if (nums <= 0) {
+        LOG_I ("%p socks5 server resolve addr", self);
+        return -1;
+    }
+
+    return nums;
+}
+
+static int
+hev_socks5_server_connect (HevSocks5Server *self, HevSocks5ServerReader *rd,
+                           const HevSocks5Addr *raddr,
+                           const struct sockaddr_in6 *key,
+                           struct sockaddr_in6 *saddrs, int nums,
+                           struct sockaddr_in6 *addr)
 {
-    HevSocks5Class *klass;
+    HevSocks5FastOpen tfo = { 0 };
     int timeout;
-    int res;
     int fd;
 
     LOG_D ("%p socks5 server connect", self);
 
-    fd = hev_socks5_socket (SOCK_STREAM);
+    timeout = hev_socks5_get_connect_timeout ();
+    hev_socks5_set_timeout (HEV_SOCKS5 (self), timeout);
+
+    /*
+     * Payload the client pipelined after the request may ride in the SYN.
+     * Without any, fast open is not used: the remote may speak first.
+     */
+    tfo.data = rd->buf;
+    tfo.len = rd->len;
+
+    fd = hev_socks5_connect_resolved (HEV_SOCKS5 (self),
+                                      &HEV_SOCKS5 (self)->timeout, raddr,
+                                      saddrs, nums, addr,
+                                      rd->len ? &tfo : NULL);
     if (fd < 0) {
-        LOG_E ("%p socks5 server socket stream", self);
-        return -1;
+        LOG_I ("%p socks5 server connect", self);
+        hev_socks5_breaker_leave (key, NULL, saddrs, nums);
+        return HEV_SOCKS5_RES_REP_HOST;
     }
+    hev_socks5_breaker_leave (key, addr, NULL, 0);
 
-    klass = HEV_OBJECT_GET_CLASS (self);
-    res = klass->binder (HEV_SOCKS5 (self), fd, (struct sockaddr *)addr);
-    if (res < 0) {
-        LOG_W ("%p socks5 server bind", self);
-        hev_task_del_fd (hev_task_self (), fd);
-        close (fd);
-        return -1;
+    if (rd->len)
+        hev_socks5_tcp_fastopen_account (fd);
+
+    if (tfo.sent) {
+        ssize_t res;
+
+        res = recv (HEV_SOCKS5 (self)->fd, rd->buf, tfo.sent, 0);
+        if (res != tfo.sent) {
+            LOG_I ("%p socks5 server read fast open data", self);
+            hev_task_del_fd (hev_task_self (), fd);
+            close (fd);
+            return HEV_SOCKS5_RES_REP_FAIL;
+        }
     }
 
-    timeout = hev_socks5_get_connect_timeout ();
+    timeout = hev_socks5_get_tcp_timeout ();
     hev_socks5_set_timeout (HEV_SOCKS5 (self), timeout);
 
-    res = hev_task_io_socket_connect (fd, (struct sockaddr *)addr,
-                                      sizeof (*addr), task_io_yielder, self);
-    if (res < 0) {
-        LOG_I ("%p socks5 server connect", self);
-        hev_task_del_fd (hev_task_self (), fd);
-        close (fd);
-        return -1;
-    }
+    self->fds[0] = fd;
+
+    return HEV_SOCKS5_RES_REP_SUCC;
+}
+
+static int
+hev_socks5_server_adopt (HevSocks5Server *self, HevSocks5ServerSpec *spec,
+                         struct sockaddr_in6 *addr)
+{
+    HevTask *task = hev_task_self ();
+    int timeout;
+    int res;
+
+    LOG_D ("%p socks5 server adopt", self);
+
+    res = hev_task_add_fd (task, spec->fd, POLLIN | POLLOUT);
+    if (res < 0)
+        hev_task_mod_fd (task, spec->fd, POLLIN | POLLOUT);
 
     timeout = hev_socks5_get_tcp_timeout ();
     hev_socks5_set_timeout (HEV_SOCKS5 (self), timeout);
 
+    self->fds[0] = spec->fd;
+    *addr = spec->saddr;
+    spec->fd = -1;
+
+    return HEV_SOCKS5_RES_REP_SUCC;
+}
+
+static HevSocks5ClientPool *
+hev_socks5_server_route (HevSocks5Server *self, const HevSocks5Addr *raddr)
+{
+    HevSocks5User *user = NULL;
+
+    if (!self->router)
+        return NULL;
+
+    /* an authenticator only admits users, so obj is the user by now */
+    if (self->obj)
+        user = self->user;
+
+    return hev_socks5_router_match (self->router, user, raddr);
+}
+
+static void
+hev_socks5_server_unspec_addr (struct sockaddr_in6 *addr)
+{
+    /* 0.0.0.0:0, for replies sent without a bound address of our own */
+    memset (addr, 0, sizeof (struct sockaddr_in6));
+    addr->sin6_family = AF_INET6;
+    addr->sin6_addr.s6_addr[10] = 0xff;
+    addr->sin6_addr.s6_addr[11] = 0xff;
+}
+
+static int
+hev_socks5_server_chain (HevSocks5Server *self, HevSocks5ServerReader *rd,
+                         HevSocks5ClientPool *parent, int cmd,
+                         const HevSocks5Addr *raddr,
+                         struct sockaddr_in6 *addr)
+{
+    HevSocks5Client *client;
+    int res;
+    int fd;
+
+    LOG_D ("%p socks5 server chain", self);
+
+    if (cmd == HEV_SOCKS5_REQ_CMD_CONNECT) {
+        HevSocks5ClientTCP *tcp;
+
+        tcp = hev_malloc0 (sizeof (HevSocks5ClientTCP));
+        if (tcp && hev_socks5_client_tcp_construct (tcp, raddr) < 0) {
+            hev_free (tcp);
+            tcp = NULL;
+        }
+
+        /* payload pipelined after the request goes out with the parent's */
+        if (tcp && rd->len)
+            hev_socks5_client_tcp_set_early_data (tcp, rd->buf, rd->len);
+
+        client = HEV_SOCKS5_CLIENT (tcp);
+    } else {
+        HevSocks5ClientUDP *udp;
+
+        udp = hev_socks5_client_udp_new (HEV_SOCKS5_TYPE_UDP_IN_TCP);
+        client = HEV_SOCKS5_CLIENT (udp);
+    }
+
+    if (!client) {
+        LOG_E ("%p socks5 server chain client", self);
+        return HEV_SOCKS5_RES_REP_FAIL;
+    }
+
+    /* only a connection the pool had to dial is left to authenticate */
+    res = hev_socks5_client_pool_connect (parent, client);
+    if (res == 0)
+        res = hev_socks5_client_handshake (client, 1);
+    if (res < 0) {
+        LOG_I ("%p socks5 server chain parent", self);
+        hev_object_unref (HEV_OBJECT (client));
+        return HEV_SOCKS5_RES_REP_HOST;
+    }
+
+    /* the parent got the early data, take it off the client socket */
+    if (cmd == HEV_SOCKS5_REQ_CMD_CONNECT && rd->len) {
+        ssize_t s;
+
+        s = recv (HEV_SOCKS5 (self)->fd, rd->buf, rd->len, 0);
+        if (s != rd->len) {
+            LOG_I ("%p socks5 server read early data", self);
+            hev_object_unref (HEV_OBJECT (client));
+            return HEV_SOCKS5_RES_REP_FAIL;
+        }
+        rd->len = 0;
+    }
+
+    fd = HEV_SOCKS5 (client)->fd;
+    HEV_SOCKS5 (client)->fd = -1;
+    hev_object_unref (HEV_OBJECT (client));
+
+    /* the bound address is the parent's business */
     self->fds[0] = fd;
+    hev_socks5_server_unspec_addr (addr);
+
+    return HEV_SOCKS5_RES_REP_SUCC;
+}
+
+static int
+hev_socks5_server_connect_optimistic (HevSocks5Server *self,
+                                      HevSocks5ServerReader *rd,
+                                      const HevSocks5Addr *raddr,
+                                      const struct sockaddr_in6 *key,
+                                      struct sockaddr_in6 *saddrs, int nums)
+{
+    struct sockaddr_in6 addr;
+    int res;
+
+    LOG_D ("%p socks5 server connect optimistic", self);
+
+    /*
+     * Success goes out with an unspecified bound address before connecting,
+     * so the client can send while the connect is in flight. Its data waits
+     * in the socket until the splice starts.
+     */
+    hev_socks5_server_unspec_addr (&addr);
+
+    res = hev_socks5_server_write_response (self, rd, HEV_SOCKS5_RES_REP_SUCC,
+                                            &addr);
+    if (res < 0) {
+        hev_socks5_breaker_cancel (key);
+        return -1;
+    }
+
+    res = hev_socks5_server_connect (self, rd, raddr, key, saddrs, nums,
+                                     &addr);
+    if (res != HEV_SOCKS5_RES_REP_SUCC)
+        return -1;
 
     return 0;
 }
@@ -475,36 +1035,81 @@ hev_socks5_server_udp_bind (HevSocks5Server *self, int sock,
 }
 
 static int
-hev_socks5_server_handshake (HevSocks5Server *self)
+hev_socks5_server_request (HevSocks5Server *self, HevSocks5ServerReader *rd)
 {
+    HevSocks5ClientPool *parent;
     struct sockaddr_in6 addr;
+    struct sockaddr_in6 key;
+    HevSocks5Addr raddr;
     int timeout;
+    int nums;
     int cmd;
     int rep;
     int res;
 
-    LOG_D ("%p socks5 server handshake", self);
-
     memset (&addr, 0, sizeof (addr));
     timeout = hev_socks5_get_tcp_timeout ();
     hev_socks5_set_timeout (HEV_SOCKS5 (self), timeout);
 
-    res = hev_socks5_server_auth (self);
+    res = hev_socks5_server_auth (self, rd);
     if (res < 0)
         return -1;
 
     rep = HEV_SOCKS5_RES_REP_SUCC;
-    res = hev_socks5_server_read_request (self, &cmd, &rep, &addr);
+    rd->phase = HEV_SOCKS5_HANDSHAKE_REQUEST;
+    res = hev_socks5_server_read_request (self, rd, &cmd, &rep, &raddr, &addr);
     if (res < 0)
         return -1;
 
+    /* the request is in, its reply is not held to the read pace */
+    hev_socks5_set_timeout (HEV_SOCKS5 (self), timeout);
+
     if (rep == HEV_SOCKS5_RES_REP_SUCC) {
+        rd->port = hev_socks5_addr_get_port (&raddr);
+
         switch (cmd) {
         case HEV_SOCKS5_REQ_CMD_CONNECT:
-            res = hev_socks5_server_connect (self, &addr);
-            if (res < 0)
-                rep = HEV_SOCKS5_RES_REP_HOST;
             HEV_SOCKS5 (self)->type = HEV_SOCKS5_TYPE_TCP;
+            parent = hev_socks5_server_route (self, &raddr);
+            if (parent) {
+                rep = hev_socks5_server_chain (self, rd, parent, cmd, &raddr,
+                                               &addr);
+                break;
+            }
+            nums = hev_socks5_server_spec_join (self, rd->spec, &raddr,
+                                                rd->saddrs);
+            if (nums < 0) {
+                rep = HEV_SOCKS5_RES_REP_ADDR;
+                break;
+            }
+            if (rd->spec && rd->spec->fd >= 0) {
+                rep = hev_socks5_server_adopt (self, rd->spec, &addr);
+                break;
+            }
+            /* the speculative connect failed or was refused by the breaker */
+            if (rd->spec && rd->spec->connect) {
+                rep = HEV_SOCKS5_RES_REP_HOST;
+                break;
+            }
+            /* a target backing off is not worth resolving either */
+            hev_socks5_breaker_key (&raddr, &key);
+            if (hev_socks5_breaker_enter (&key) < 0) {
+                LOG_I ("%p socks5 server connect backing off", self);
+                rep = HEV_SOCKS5_RES_REP_HOST;
+                break;
+            }
+            if (nums == 0)
+                nums = hev_socks5_server_resolve (self, &raddr, rd->saddrs);
+            if (nums < 0) {
+                hev_socks5_breaker_cancel (&key);
+                rep = HEV_SOCKS5_RES_REP_ADDR;
+                break;
+            }
+            if (hev_socks5_get_connect_optimistic ())
+                return hev_socks5_server_connect_optimistic (
+                    self, rd, &raddr, &key, rd->saddrs, nums);
+            rep = hev_socks5_server_connect (self, rd, &raddr, &key,
+                                             rd->saddrs, nums, &addr);
             break;
         case HEV_SOCKS5_REQ_CMD_UDP_ASC:
             res = hev_socks5_server_bind (self, &addr);
@@ -513,6 +1118,17 @@ hev_socks5_server_handshake (HevSocks5Server *self)
             HEV_SOCKS5 (self)->type = HEV_SOCKS5_TYPE_UDP_IN_UDP;
             break;
         case HEV_SOCKS5_REQ_CMD_FWD_UDP:
+            /*
+             * The parent speaks the same framing, so bytes pass through.
+             * Routed on the request address, not per datagram.
+             */
+            parent = hev_socks5_server_route (self, &raddr);
+            if (parent) {
+                HEV_SOCKS5 (self)->type = HEV_SOCKS5_TYPE_TCP;
+                rep = hev_socks5_server_chain (self, rd, parent, cmd, &raddr,
+                                               &addr);
+                break;
+            }
             res = hev_socks5_server_bind (self, NULL);
             if (res < 0)
                 rep = HEV_SOCKS5_RES_REP_FAIL;
@@ -524,13 +1140,66 @@ hev_socks5_server_handshake (HevSocks5Server *self)
         }
     }
 
-    res = hev_socks5_server_write_response (self, rep, &addr);
+    res = hev_socks5_server_write_response (self, rd, rep, &addr);
     if ((res < 0) || (rep != HEV_SOCKS5_RES_REP_SUCC))
         return -1;
 
     return 0;
 }
 
+static void
+hev_socks5_server_tune (HevSocks5Server *self, int port)
+{
+    const HevSocks5SocketProfile *profile = NULL;
+    HevSocks5Type type = HEV_SOCKS5 (self)->type;
+
+    /* an authenticator only admits users, so obj is the user by now */
+    if (self->obj)
+        profile = self->user->profile;
+
+    if (!profile) {
+        if (type != HEV_SOCKS5_TYPE_TCP)
+            port = 0;
+        profile = hev_socks5_get_socket_profile (type, port);
+    }
+
+    hev_socks5_socket_profile_apply (HEV_SOCKS5 (self)->fd, profile);
+    hev_socks5_socket_profile_apply (self->fds[0], profile);
+}
+
+static int
+hev_socks5_server_handshake (HevSocks5Server *self)
+{
+    HevSocks5ServerReader *rd;
+    int res;
+
+    LOG_D ("%p socks5 server handshake", self);
+
+    /* too big for the default task stack along with the calls below */
+    rd = hev_malloc (sizeof (HevSocks5ServerReader));
+    if (!rd)
+        return -1;
+
+    rd->off = 0;
+    rd->len = 0;
+    rd->olen = 0;
+    rd->seen = 0;
+    rd->port = 0;
+    rd->start = hev_socks5_now ();
+    rd->phase = HEV_SOCKS5_HANDSHAKE_GREETING;
+    rd->spec = NULL;
+
+    res = hev_socks5_server_request (self, rd);
+    hev_socks5_server_spec_cancel (self, rd);
+
+    /* by the requested port, as the upstream of a chain is the parent */
+    if (res == 0)
+        hev_socks5_server_tune (self, rd->port);
+    hev_free (rd);
+
+    return res;
+}
+
 static int
 hev_socks5_server_service (HevSocks5Server *self)
 {
@@ -569,7 +1238,12 @@ hev_socks5_server_run (HevSocks5Server *self)
     if (res < 0)
         hev_task_mod_fd (task, fd, POLLIN | POLLOUT);
 
+    res = hev_socks5_admission_enter (fd);
+    if (res < 0)
+        return -1;
+
     res = hev_socks5_server_handshake (self);
+    hev_socks5_admission_leave ();
     if (res < 0)
         return -1;
 
@@ -639,6 +1313,8 @@ hev_socks5_server_destruct (HevObject *base)
 
     if (self->obj)
         hev_object_unref (self->obj);
+    if (self->router)
+        hev_object_unref (HEV_OBJECT (self->router));
 
     HEV_SOCKS5_TYPE->destruct (base);
 }
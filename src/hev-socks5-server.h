@@ -16,6 +16,7 @@
 #include "hev-socks5-tcp.h"
 #include "hev-socks5-udp.h"
 #include "hev-socks5-user.h"
+#include "hev-socks5-router.h"
 #include "hev-socks5-authenticator.h"
 
 #ifdef __cplusplus
@@ -41,6 +42,8 @@ struct _HevSocks5Server
         HevSocks5User *user;
         HevSocks5Authenticator *auth;
     };
+
+    HevSocks5Router *router;
 };
 
 struct _HevSocks5ServerClass
@@ -62,6 +65,15 @@ HevSocks5Server *hev_socks5_server_new (int fd);
 void hev_socks5_server_set_auth (HevSocks5Server *self,
                                  HevSocks5Authenticator *auth);
 
+/*
+ * Sends the CONNECT and FWD UDP requests the router matches through its
+ * parent proxies, over their pooled connections. The session then relays
+ * between the client and the parent connection directly. UDP ASSOCIATE
+ * requests are never chained.
+ */
+void hev_socks5_server_set_router (HevSocks5Server *self,
+                                   HevSocks5Router *router);
+
 int hev_socks5_server_run (HevSocks5Server *self);
 
 #ifdef __cplusplus
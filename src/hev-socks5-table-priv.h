@@ -0,0 +1,42 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-table-priv.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Table Private
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_TABLE_PRIV_H__
+#define __HEV_SOCKS5_TABLE_PRIV_H__
+
+#include <netinet/in.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _HevSocks5Table HevSocks5Table;
+typedef int (*HevSocks5TableFunc) (void *value, int fresh, void *data);
+
+/*
+ * A bounded table of small fixed-size values keyed by socket address,
+ * shared by all threads. It is split into locked shards of 4-way sets, and
+ * a key that finds its set full evicts the least recently used entry.
+ */
+HevSocks5Table *hev_socks5_table_new (int size, int value_size);
+void hev_socks5_table_destroy (HevSocks5Table *self);
+
+/*
+ * Calls func with the value of key under its shard lock, fresh and zeroed
+ * when the key was not present, and returns what func returns.
+ */
+int hev_socks5_table_apply (HevSocks5Table *self,
+                            const struct sockaddr_in6 *key,
+                            HevSocks5TableFunc func, void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_SOCKS5_TABLE_PRIV_H__ */
@@ -0,0 +1,167 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-table.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Table
+ ============================================================================
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "hev-socks5-table-priv.h"
+
+#define TABLE_SHARDS (16)
+#define TABLE_WAYS (4)
+
+typedef struct _HevSocks5TableEntry HevSocks5TableEntry;
+typedef struct _HevSocks5TableShard HevSocks5TableShard;
+
+struct _HevSocks5TableEntry
+{
+    uint64_t used; /* 0: free */
+    struct in6_addr addr;
+    in_port_t port;
+
+    uint64_t value[];
+};
+
+struct _HevSocks5TableShard
+{
+    pthread_mutex_t lock;
+    uint64_t clock;
+    uint8_t *entries;
+};
+
+struct _HevSocks5Table
+{
+    int sets;
+    int value_size;
+    size_t stride;
+
+    HevSocks5TableShard shards[TABLE_SHARDS];
+};
+
+HevSocks5Table *
+hev_socks5_table_new (int size, int value_size)
+{
+    HevSocks5Table *self;
+    size_t len;
+    int i;
+
+    self = calloc (1, sizeof (HevSocks5Table));
+    if (!self)
+        return NULL;
+
+    self->sets = size / (TABLE_SHARDS * TABLE_WAYS);
+    if (self->sets == 0)
+        self->sets = 1;
+
+    self->value_size = value_size;
+    self->stride = sizeof (HevSocks5TableEntry);
+    self->stride += (value_size + 7) & ~7;
+
+    len = self->stride * self->sets * TABLE_WAYS;
+    for (i = 0; i < TABLE_SHARDS; i++) {
+        HevSocks5TableShard *shard = &self->shards[i];
+
+        shard->entries = calloc (1, len);
+        if (!shard->entries) {
+            hev_socks5_table_destroy (self);
+            return NULL;
+        }
+        pthread_mutex_init (&shard->lock, NULL);
+    }
+
+    return self;
+}
+
+void
+hev_socks5_table_destroy (HevSocks5Table *self)
+{
+    int i;
+
+    for (i = 0; i < TABLE_SHARDS; i++) {
+        HevSocks5TableShard *shard = &self->shards[i];
+
+        if (!shard->entries)
+            continue;
+
+        pthread_mutex_destroy (&shard->lock);
+        free (shard->entries);
+    }
+
+    free (self);
+}
+
+static unsigned int
+hev_socks5_table_hash (const struct sockaddr_in6 *key)
+{
+    const uint8_t *p = (const uint8_t *)&key->sin6_addr;
+    unsigned int hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < 16; i++)
+        hash = (hash ^ p[i]) * 16777619u;
+
+    hash = (hash ^ (key->sin6_port & 0xff)) * 16777619u;
+    hash = (hash ^ (key->sin6_port >> 8)) * 16777619u;
+
+    return hash;
+}
+
+static HevSocks5TableEntry *
+hev_socks5_table_find (HevSocks5Table *self, uint8_t *set,
+                       const struct sockaddr_in6 *key, int *fresh)
+{
+    HevSocks5TableEntry *victim = NULL;
+    int i;
+
+    for (i = 0; i < TABLE_WAYS; i++) {
+        HevSocks5TableEntry *e = (void *)&set[self->stride * i];
+
+        if (e->used && e->port == key->sin6_port &&
+            memcmp (&e->addr, &key->sin6_addr, sizeof (e->addr)) == 0) {
+            *fresh = 0;
+            return e;
+        }
+
+        if (!victim || e->used < victim->used)
+            victim = e;
+    }
+
+    victim->addr = key->sin6_addr;
+    victim->port = key->sin6_port;
+    memset (victim->value, 0, self->value_size);
+    *fresh = 1;
+
+    return victim;
+}
+
+int
+hev_socks5_table_apply (HevSocks5Table *self, const struct sockaddr_in6 *key,
+                        HevSocks5TableFunc func, void *data)
+{
+    HevSocks5TableShard *shard;
+    HevSocks5TableEntry *e;
+    unsigned int hash;
+    uint8_t *set;
+    int fresh;
+    int res;
+
+    hash = hev_socks5_table_hash (key);
+    shard = &self->shards[hash % TABLE_SHARDS];
+
+    pthread_mutex_lock (&shard->lock);
+    set = &shard->entries[self->stride * TABLE_WAYS *
+                          ((hash / TABLE_SHARDS) % self->sets)];
+    e = hev_socks5_table_find (self, set, key, &fresh);
+    e->used = ++shard->clock;
+    res = func (e->value, fresh, data);
+    pthread_mutex_unlock (&shard->lock);
+
+    return res;
+}
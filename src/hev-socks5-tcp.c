@@ -2,23 +2,358 @@
  ============================================================================
  Name        : hev-socks5-tcp.c
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2021 hev
+ Copyright   : Copyright (c) 2021 - 2026 hev
  Description : Socks5 TCP
  ============================================================================
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-memory-allocator.h>
+
 #include "hev-socks5.h"
 #include "hev-socks5-misc-priv.h"
 #include "hev-socks5-logger-priv.h"
+#include "hev-socks5-worker-priv.h"
 
 #include "hev-socks5-tcp.h"
 
+#define TCP_BUF_SIZE 8192
+
 #define task_io_yielder hev_socks5_task_io_yielder
 
+typedef struct _HevSocks5TCPDir HevSocks5TCPDir;
+typedef struct _HevSocks5TCPDuplex HevSocks5TCPDuplex;
+
+struct _HevSocks5TCPDir
+{
+    int fdi;
+    int fdo;
+    size_t off;
+    size_t len;
+    size_t total;
+    unsigned char buf[TCP_BUF_SIZE];
+};
+
+struct _HevSocks5TCPDuplex
+{
+    int refs;
+    int quit;
+    int done;
+    int timeout;
+    int notify[2];
+    int64_t active;
+
+    HevSocks5TCPDir dir;
+};
+
+static int
+hev_socks5_tcp_copy (HevSocks5TCPDir *dir)
+{
+    ssize_t s;
+    int res = 0;
+
+    if (!dir->len) {
+        s = read (dir->fdi, dir->buf, TCP_BUF_SIZE);
+        if (s == 0) {
+            shutdown (dir->fdo, SHUT_WR);
+            return -1;
+        }
+        if (s < 0) {
+            if (errno == EAGAIN)
+                return 0;
+            return -2;
+        }
+        dir->off = 0;
+        dir->len = s;
+        res = 1;
+    }
+
+    s = write (dir->fdo, dir->buf + dir->off, dir->len);
+    if (s < 0) {
+        if (errno == EAGAIN)
+            return res;
+        return -2;
+    }
+    dir->off += s;
+    dir->len -= s;
+    dir->total += s;
+
+    return 1;
+}
+
+static void
+hev_socks5_tcp_duplex_unref (HevSocks5TCPDuplex *self)
+{
+    if (__atomic_sub_fetch (&self->refs, 1, __ATOMIC_ACQ_REL))
+        return;
+
+    close (self->notify[0]);
+    close (self->notify[1]);
+    free (self);
+}
+
+static void
+hev_socks5_tcp_duplex_abort (HevSocks5TCPDuplex *self, HevSocks5TCPDir *dir)
+{
+    __atomic_store_n (&self->quit, 1, __ATOMIC_RELEASE);
+
+    /* wakes the other direction wherever it is blocked */
+    shutdown (dir->fdi, SHUT_RDWR);
+    shutdown (dir->fdo, SHUT_RDWR);
+}
+
+static int
+hev_socks5_tcp_duplex_yielder (HevTaskYieldType type, void *data)
+{
+    HevSocks5TCPDuplex *self = data;
+
+    if (type == HEV_TASK_YIELD) {
+        hev_task_yield (HEV_TASK_YIELD);
+    } else if (self->timeout < 0) {
+        hev_task_yield (HEV_TASK_WAITIO);
+    } else if (hev_socks5_task_wait (self->timeout) <= 0) {
+        int64_t active = __atomic_load_n (&self->active, __ATOMIC_RELAXED);
+
+        if ((hev_socks5_now () - active) >= self->timeout) {
+            LOG_I ("%p io timeout", self);
+            return -1;
+        }
+    }
+
+    return __atomic_load_n (&self->quit, __ATOMIC_ACQUIRE) ? -1 : 0;
+}
+
+static void
+hev_socks5_tcp_duplex_relay (HevSocks5TCPDuplex *self, HevSocks5TCPDir *dir)
+{
+    for (;;) {
+        int res;
+
+        res = hev_socks5_tcp_copy (dir);
+        if (res == -1)
+            break;
+        if (res < 0) {
+            hev_socks5_tcp_duplex_abort (self, dir);
+            break;
+        }
+
+        if (res > 0) {
+            int64_t now = hev_socks5_now ();
+            __atomic_store_n (&self->active, now, __ATOMIC_RELAXED);
+            res = hev_socks5_tcp_duplex_yielder (HEV_TASK_YIELD, self);
+        } else {
+            res = hev_socks5_tcp_duplex_yielder (HEV_TASK_WAITIO, self);
+        }
+        if (res < 0) {
+            hev_socks5_tcp_duplex_abort (self, dir);
+            break;
+        }
+    }
+}
+
+static void
+hev_socks5_tcp_duplex_finish (HevSocks5TCPDuplex *self)
+{
+    char c = 0;
+
+    close (self->dir.fdi);
+    close (self->dir.fdo);
+
+    __atomic_store_n (&self->done, 1, __ATOMIC_RELEASE);
+    if (write (self->notify[1], &c, 1)) {
+        /* ignore return value */
+    }
+    hev_socks5_tcp_duplex_unref (self);
+}
+
+static void
+hev_socks5_tcp_duplex_task_entry (void *data)
+{
+    HevSocks5TCPDuplex *self = data;
+    HevTask *task = hev_task_self ();
+
+    LOG_D ("%p socks5 tcp duplex task", self);
+
+    hev_task_add_fd (task, self->dir.fdi, POLLIN);
+    hev_task_add_fd (task, self->dir.fdo, POLLOUT);
+
+    hev_socks5_tcp_duplex_relay (self, &self->dir);
+
+    hev_task_del_fd (task, self->dir.fdi);
+    hev_task_del_fd (task, self->dir.fdo);
+
+    hev_socks5_tcp_duplex_finish (self);
+}
+
+static void
+hev_socks5_tcp_duplex_drop (void *data)
+{
+    HevSocks5TCPDuplex *self = data;
+
+    /* nothing relays this direction, so end the session instead */
+    hev_socks5_tcp_duplex_abort (self, &self->dir);
+    hev_socks5_tcp_duplex_finish (self);
+}
+
+static int
+hev_socks5_tcp_duplex_spawn (HevSocks5TCPDuplex *self)
+{
+    HevTask *task;
+
+    if (hev_socks5_get_tcp_duplex_threaded ()) {
+        if (hev_socks5_worker_spawn (hev_socks5_tcp_duplex_task_entry,
+                                     hev_socks5_tcp_duplex_drop, self) == 0)
+            return 0;
+
+        LOG_W ("%p socks5 tcp duplex worker", self);
+    }
+
+    task = hev_task_new (hev_socks5_get_task_stack_size ());
+    if (!task)
+        return -1;
+
+    hev_task_run (task, hev_socks5_tcp_duplex_task_entry, self);
+
+    return 0;
+}
+
+static int
+hev_socks5_tcp_splice_duplex (HevSocks5TCP *self, HevSocks5TCPDir *dir_f,
+                              HevSocks5TCPDir *dir_b)
+{
+    HevSocks5TCPDuplex *duplex;
+    HevTask *task = hev_task_self ();
+
+    LOG_D ("%p socks5 tcp splice duplex", self);
+
+    /* may be freed by a worker thread */
+    duplex = malloc (sizeof (HevSocks5TCPDuplex));
+    if (!duplex)
+        return -1;
+
+    if (pipe (duplex->notify) < 0) {
+        free (duplex);
+        return -1;
+    }
+    fcntl (duplex->notify[0], F_SETFL, O_NONBLOCK);
+    fcntl (duplex->notify[1], F_SETFL, O_NONBLOCK);
+
+    duplex->refs = 2;
+    duplex->quit = 0;
+    duplex->done = 0;
+    duplex->timeout = HEV_SOCKS5 (self)->timeout;
+    duplex->active = hev_socks5_now ();
+    duplex->dir = *dir_b;
+
+    /* private fds give the other task its own poll registration */
+    duplex->dir.fdi = dup (dir_b->fdi);
+    duplex->dir.fdo = dup (dir_b->fdo);
+
+    if (duplex->dir.fdi < 0 || duplex->dir.fdo < 0 ||
+        hev_socks5_tcp_duplex_spawn (duplex) < 0) {
+        LOG_W ("%p socks5 tcp duplex spawn", self);
+        if (duplex->dir.fdi >= 0)
+            close (duplex->dir.fdi);
+        if (duplex->dir.fdo >= 0)
+            close (duplex->dir.fdo);
+        close (duplex->notify[0]);
+        close (duplex->notify[1]);
+        free (duplex);
+        return -1;
+    }
+
+    hev_socks5_tcp_duplex_relay (duplex, dir_f);
+
+    hev_task_add_fd (task, duplex->notify[0], POLLIN);
+    while (!__atomic_load_n (&duplex->done, __ATOMIC_ACQUIRE)) {
+        char buf[8];
+
+        if (read (duplex->notify[0], buf, sizeof (buf)) <= 0)
+            hev_task_yield (HEV_TASK_WAITIO);
+    }
+    hev_task_del_fd (task, duplex->notify[0]);
+
+    hev_socks5_tcp_duplex_unref (duplex);
+
+    return 0;
+}
+
+static void
+hev_socks5_tcp_splice_adaptive (HevSocks5TCP *self, int cfd, int fd,
+                                int threshold)
+{
+    HevSocks5TCPDir *dirs;
+    int res_f = 1, res_b = 1;
+    size_t bytes = 0;
+    int64_t start;
+
+    LOG_D ("%p socks5 tcp splice adaptive", self);
+
+    dirs = hev_malloc (sizeof (HevSocks5TCPDir) * 2);
+    if (!dirs)
+        return;
+
+    dirs[0].fdi = cfd;
+    dirs[0].fdo = fd;
+    dirs[0].len = 0;
+    dirs[0].total = 0;
+    dirs[1].fdi = fd;
+    dirs[1].fdo = cfd;
+    dirs[1].len = 0;
+    dirs[1].total = 0;
+
+    start = hev_socks5_now ();
+
+    for (;;) {
+        HevTaskYieldType type;
+
+        if (res_f >= 0)
+            res_f = hev_socks5_tcp_copy (&dirs[0]);
+        if (res_b >= 0)
+            res_b = hev_socks5_tcp_copy (&dirs[1]);
+
+        /* an error in either direction ends the session */
+        if (res_f < -1 || res_b < -1)
+            break;
+
+        if (res_f > 0 || res_b > 0) {
+            int64_t now = hev_socks5_now ();
+
+            if ((now - start) >= 1000) {
+                size_t total = dirs[0].total + dirs[1].total;
+                size_t rate = (total - bytes) * 1000 / (now - start);
+
+                if (rate >= (size_t)threshold && res_f >= 0 && res_b >= 0 &&
+                    !hev_socks5_tcp_splice_duplex (self, &dirs[0], &dirs[1]))
+                    break;
+                start = now;
+                bytes = total;
+            }
+            type = HEV_TASK_YIELD;
+        } else if ((res_f & res_b) == 0) {
+            type = HEV_TASK_WAITIO;
+        } else {
+            break;
+        }
+
+        if (task_io_yielder (type, self))
+            break;
+    }
+
+    hev_free (dirs);
+}
+
 static int
 hev_socks5_tcp_splicer (HevSocks5TCP *self, int fd)
 {
     HevTask *task = hev_task_self ();
+    int threshold;
     int cfd;
     int res;
 
@@ -32,6 +367,12 @@ hev_socks5_tcp_splicer (HevSocks5TCP *self, int fd)
     if (res < 0)
         hev_task_mod_fd (task, fd, POLLIN | POLLOUT);
 
+    threshold = hev_socks5_get_tcp_duplex_threshold ();
+    if (threshold > 0) {
+        hev_socks5_tcp_splice_adaptive (self, cfd, fd, threshold);
+        return 0;
+    }
+
     hev_task_io_splice (cfd, cfd, fd, fd, 8192, task_io_yielder, self);
 
     return 0;
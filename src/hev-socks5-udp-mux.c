@@ -0,0 +1,494 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-udp-mux.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 UDP Mux
+ ============================================================================
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <hev-task.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-socks5.h"
+#include "hev-compiler.h"
+#include "hev-socks5-misc-priv.h"
+#include "hev-socks5-logger-priv.h"
+
+#include "hev-socks5-udp-mux.h"
+
+#define MUX_BUF_SIZE 2048
+#define MUX_BATCH 32
+#define MUX_QUEUE 64
+#define MUX_TX_QUEUE 256
+
+HevSocks5UDPMux *
+hev_socks5_udp_mux_new (HevSocks5UDP *udp)
+{
+    HevSocks5UDPMux *self;
+    int res;
+
+    self = hev_malloc0 (sizeof (HevSocks5UDPMux));
+    if (!self)
+        return NULL;
+
+    res = hev_socks5_udp_mux_construct (self, udp);
+    if (res < 0) {
+        hev_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p socks5 udp mux new", self);
+
+    return self;
+}
+
+static int
+hev_socks5_udp_mux_cmp (HevSocks5UDPMuxFlow *flow, const HevSocks5Addr *addr,
+                        int alen)
+{
+    if (flow->alen < alen)
+        return -1;
+    if (flow->alen > alen)
+        return 1;
+
+    return memcmp (&flow->addr, addr, alen);
+}
+
+static HevSocks5UDPMuxFlow *
+hev_socks5_udp_mux_find (HevSocks5UDPMux *self, const HevSocks5Addr *addr)
+{
+    HevRBTreeNode *node = self->flows.root;
+    int alen;
+
+    alen = hev_socks5_addr_len (addr);
+    if (alen <= 0)
+        return NULL;
+
+    while (node) {
+        HevSocks5UDPMuxFlow *this;
+        int res;
+
+        this = container_of (node, HevSocks5UDPMuxFlow, node);
+        res = hev_socks5_udp_mux_cmp (this, addr, alen);
+
+        if (res < 0)
+            node = node->left;
+        else if (res > 0)
+            node = node->right;
+        else
+            return this;
+    }
+
+    return NULL;
+}
+
+HevSocks5UDPMuxFlow *
+hev_socks5_udp_mux_open (HevSocks5UDPMux *self, const HevSocks5Addr *addr)
+{
+    HevRBTreeNode **new = &self->flows.root, *parent = NULL;
+    HevSocks5UDPMuxFlow *flow;
+    int alen;
+
+    alen = hev_socks5_addr_len (addr);
+    if (alen <= 0)
+        return NULL;
+
+    while (*new) {
+        HevSocks5UDPMuxFlow *this;
+        int res;
+
+        this = container_of (*new, HevSocks5UDPMuxFlow, node);
+        res = hev_socks5_udp_mux_cmp (this, addr, alen);
+
+        parent = *new;
+        if (res < 0)
+            new = &((*new)->left);
+        else if (res > 0)
+            new = &((*new)->right);
+        else
+            return NULL;
+    }
+
+    flow = hev_malloc0 (sizeof (HevSocks5UDPMuxFlow));
+    if (!flow)
+        return NULL;
+
+    LOG_D ("%p socks5 udp mux open %p", self, flow);
+
+    flow->refs = 1;
+    flow->alen = alen;
+    memcpy (&flow->addr, addr, alen);
+
+    hev_rbtree_node_link (&flow->node, parent, new);
+    hev_rbtree_insert_color (&self->flows, &flow->node);
+
+    return flow;
+}
+
+static void
+hev_socks5_udp_mux_flow_unref (HevSocks5UDPMuxFlow *flow)
+{
+    if (--flow->refs)
+        return;
+
+    while (flow->head) {
+        HevSocks5UDPMuxPacket *p = flow->head;
+
+        flow->head = p->next;
+        hev_free (p);
+    }
+
+    hev_free (flow);
+}
+
+void
+hev_socks5_udp_mux_close (HevSocks5UDPMux *self, HevSocks5UDPMuxFlow *flow)
+{
+    LOG_D ("%p socks5 udp mux close %p", self, flow);
+
+    hev_rbtree_erase (&self->flows, &flow->node);
+
+    flow->closed = 1;
+    if (flow->task)
+        hev_task_wakeup (flow->task);
+    hev_socks5_udp_mux_flow_unref (flow);
+}
+
+ssize_t
+hev_socks5_udp_mux_send (HevSocks5UDPMux *self, HevSocks5UDPMuxFlow *flow,
+                         const void *buf, size_t len)
+{
+    HevSocks5UDPMuxPacket *p;
+
+    if (self->quit)
+        return -1;
+
+    if (len > MUX_BUF_SIZE || self->nums >= MUX_TX_QUEUE) {
+        self->drops++;
+        return -1;
+    }
+
+    p = hev_malloc (sizeof (HevSocks5UDPMuxPacket) + flow->alen + len);
+    if (!p)
+        return -1;
+
+    p->next = NULL;
+    p->alen = flow->alen;
+    p->len = len;
+    memcpy (p->data, &flow->addr, flow->alen);
+    memcpy (p->data + flow->alen, buf, len);
+
+    if (self->tail)
+        self->tail->next = p;
+    else
+        self->head = p;
+    self->tail = p;
+    self->nums++;
+
+    if (self->idle)
+        hev_task_wakeup (self->pump);
+
+    return len;
+}
+
+ssize_t
+hev_socks5_udp_mux_recv (HevSocks5UDPMux *self, HevSocks5UDPMuxFlow *flow,
+                         void *buf, size_t len, int timeout)
+{
+    HevSocks5UDPMuxPacket *p;
+
+    /* a close while this task waits must not free the flow under it */
+    flow->refs++;
+    while (!flow->head) {
+        if (self->quit || flow->closed || !timeout) {
+            hev_socks5_udp_mux_flow_unref (flow);
+            return -1;
+        }
+
+        flow->task = hev_task_self ();
+        if (timeout < 0)
+            hev_task_yield (HEV_TASK_WAITIO);
+        else
+            timeout = hev_task_sleep (timeout);
+        flow->task = NULL;
+    }
+    hev_socks5_udp_mux_flow_unref (flow);
+
+    p = flow->head;
+    flow->head = p->next;
+    if (!flow->head)
+        flow->tail = NULL;
+    flow->nums--;
+
+    if (len > p->len)
+        len = p->len;
+    memcpy (buf, p->data, len);
+    hev_free (p);
+
+    return len;
+}
+
+static void
+hev_socks5_udp_mux_route (HevSocks5UDPMux *self, HevSocks5UDPMsg *msg)
+{
+    HevSocks5UDPMuxFlow *flow;
+    HevSocks5UDPMuxPacket *p;
+
+    flow = hev_socks5_udp_mux_find (self, msg->addr);
+    if (!flow || flow->nums >= MUX_QUEUE) {
+        self->drops++;
+        return;
+    }
+
+    p = hev_malloc (sizeof (HevSocks5UDPMuxPacket) + msg->len);
+    if (!p)
+        return;
+
+    p->next = NULL;
+    p->alen = 0;
+    p->len = msg->len;
+    memcpy (p->data, msg->buf, msg->len);
+
+    if (flow->tail)
+        flow->tail->next = p;
+    else
+        flow->head = p;
+    flow->tail = p;
+    flow->nums++;
+
+    if (flow->task)
+        hev_task_wakeup (flow->task);
+}
+
+static int
+hev_socks5_udp_mux_read (HevSocks5UDPMux *self, void *buf)
+{
+    HevSocks5UDPMsg msgv[MUX_BATCH];
+    int i, res;
+
+    for (i = 0; i < MUX_BATCH; i++) {
+        msgv[i].buf = buf + MUX_BUF_SIZE * i;
+        msgv[i].len = MUX_BUF_SIZE;
+    }
+
+    res = hev_socks5_udp_recvmmsg (self->udp, msgv, MUX_BATCH, 1);
+    if (res < 0 && errno == EAGAIN)
+        return 0;
+    if (res <= 0)
+        return -1;
+
+    for (i = 0; i < res; i++)
+        hev_socks5_udp_mux_route (self, &msgv[i]);
+
+    return 1;
+}
+
+static int
+hev_socks5_udp_mux_write (HevSocks5UDPMux *self)
+{
+    HevSocks5UDPMuxPacket *pv[MUX_BATCH];
+    HevSocks5UDPMsg msgv[MUX_BATCH];
+    int i, n, res;
+
+    if (!self->head)
+        return 0;
+
+    for (n = 0; n < MUX_BATCH && self->head; n++) {
+        HevSocks5UDPMuxPacket *p = self->head;
+
+        msgv[n].addr = (HevSocks5Addr *)p->data;
+        msgv[n].buf = p->data + p->alen;
+        msgv[n].len = p->len;
+        pv[n] = p;
+
+        self->head = p->next;
+        self->nums--;
+    }
+    if (!self->head)
+        self->tail = NULL;
+
+    res = hev_socks5_udp_sendmmsg (self->udp, msgv, n);
+
+    for (i = 0; i < n; i++)
+        hev_free (pv[i]);
+
+    return res <= 0 ? -1 : 1;
+}
+
+static void
+hev_socks5_udp_mux_wake_flows (HevSocks5UDPMux *self)
+{
+    HevRBTreeNode *node;
+
+    for (node = hev_rbtree_first (&self->flows); node;
+         node = hev_rbtree_node_next (node)) {
+        HevSocks5UDPMuxFlow *flow;
+
+        flow = container_of (node, HevSocks5UDPMuxFlow, node);
+        if (flow->task)
+            hev_task_wakeup (flow->task);
+    }
+}
+
+static void
+hev_socks5_udp_mux_pump_entry (void *data)
+{
+    HevSocks5UDPMux *self = data;
+    HevTask *task = hev_task_self ();
+    void *buf;
+    int fd;
+
+    LOG_D ("%p socks5 udp mux pump", self);
+
+    fd = hev_socks5_udp_get_fd (self->udp);
+    buf = hev_malloc (MUX_BUF_SIZE * MUX_BATCH);
+    if (!buf)
+        goto exit;
+
+    if (hev_task_add_fd (task, fd, POLLIN | POLLOUT) < 0)
+        hev_task_mod_fd (task, fd, POLLIN | POLLOUT);
+
+    while (!self->quit) {
+        int res_r, res_w;
+
+        res_r = hev_socks5_udp_mux_read (self, buf);
+        res_w = hev_socks5_udp_mux_write (self);
+        if (res_r < 0 || res_w < 0)
+            break;
+
+        if (res_r > 0 || res_w > 0) {
+            hev_task_yield (HEV_TASK_YIELD);
+            continue;
+        }
+
+        self->idle = 1;
+        res_r = hev_socks5_task_io_yielder (HEV_TASK_WAITIO, self->udp);
+        self->idle = 0;
+        if (res_r < 0)
+            break;
+    }
+
+    hev_task_del_fd (task, fd);
+    hev_free (buf);
+
+exit:
+    self->quit = 1;
+    self->pump = NULL;
+    hev_socks5_udp_mux_wake_flows (self);
+    hev_object_unref (HEV_OBJECT (self));
+}
+
+int
+hev_socks5_udp_mux_start (HevSocks5UDPMux *self)
+{
+    HevTask *task;
+    int fd;
+
+    LOG_D ("%p socks5 udp mux start", self);
+
+    if (self->pump || self->quit)
+        return -1;
+
+    task = hev_task_new (hev_socks5_get_task_stack_size ());
+    if (!task)
+        return -1;
+
+    /* the pump task takes over the poll registration */
+    fd = hev_socks5_udp_get_fd (self->udp);
+    hev_task_del_fd (hev_task_self (), fd);
+
+    self->pump = task;
+    hev_object_ref (HEV_OBJECT (self));
+    hev_task_run (task, hev_socks5_udp_mux_pump_entry, self);
+
+    return 0;
+}
+
+void
+hev_socks5_udp_mux_stop (HevSocks5UDPMux *self)
+{
+    LOG_D ("%p socks5 udp mux stop", self);
+
+    self->quit = 1;
+
+    if (self->pump) {
+        /* fails the pump wherever it is blocked on the session socket */
+        shutdown (hev_socks5_udp_get_fd (self->udp), SHUT_RDWR);
+        hev_task_wakeup (self->pump);
+    }
+    hev_socks5_udp_mux_wake_flows (self);
+}
+
+int
+hev_socks5_udp_mux_construct (HevSocks5UDPMux *self, HevSocks5UDP *udp)
+{
+    int res;
+
+    if (HEV_SOCKS5 (udp)->type != HEV_SOCKS5_TYPE_UDP_IN_TCP)
+        return -1;
+
+    res = hev_object_construct (&self->base);
+    if (res < 0)
+        return res;
+
+    LOG_D ("%p socks5 udp mux construct", self);
+
+    HEV_OBJECT (self)->klass = HEV_SOCKS5_UDP_MUX_TYPE;
+
+    hev_object_ref (HEV_OBJECT (udp));
+    self->udp = udp;
+
+    return 0;
+}
+
+static void
+hev_socks5_udp_mux_destruct (HevObject *base)
+{
+    HevSocks5UDPMux *self = HEV_SOCKS5_UDP_MUX (base);
+    HevRBTreeNode *n;
+
+    LOG_D ("%p socks5 udp mux destruct", self);
+
+    while ((n = hev_rbtree_first (&self->flows))) {
+        HevSocks5UDPMuxFlow *flow;
+
+        flow = container_of (n, HevSocks5UDPMuxFlow, node);
+        hev_rbtree_erase (&self->flows, n);
+        flow->closed = 1;
+        hev_socks5_udp_mux_flow_unref (flow);
+    }
+
+    while (self->head) {
+        HevSocks5UDPMuxPacket *p = self->head;
+
+        self->head = p->next;
+        hev_free (p);
+    }
+
+    hev_object_unref (HEV_OBJECT (self->udp));
+
+    HEV_OBJECT_TYPE->destruct (base);
+    hev_free (base);
+}
+
+HevObjectClass *
+hev_socks5_udp_mux_class (void)
+{
+    static HevSocks5UDPMuxClass klass;
+    HevSocks5UDPMuxClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        memcpy (kptr, HEV_OBJECT_TYPE, sizeof (HevObjectClass));
+
+        okptr->name = "HevSocks5UDPMux";
+        okptr->destruct = hev_socks5_udp_mux_destruct;
+    }
+
+    return okptr;
+}
@@ -0,0 +1,122 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-udp-mux.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 UDP Mux
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_UDP_MUX_H__
+#define __HEV_SOCKS5_UDP_MUX_H__
+
+#include <sys/types.h>
+
+#include <hev-task.h>
+#include <hev-object.h>
+
+#include "hev-rbtree.h"
+#include "hev-socks5-udp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_SOCKS5_UDP_MUX(p) ((HevSocks5UDPMux *)p)
+#define HEV_SOCKS5_UDP_MUX_CLASS(p) ((HevSocks5UDPMuxClass *)p)
+#define HEV_SOCKS5_UDP_MUX_TYPE (hev_socks5_udp_mux_class ())
+
+typedef struct _HevSocks5UDPMux HevSocks5UDPMux;
+typedef struct _HevSocks5UDPMuxFlow HevSocks5UDPMuxFlow;
+typedef struct _HevSocks5UDPMuxPacket HevSocks5UDPMuxPacket;
+typedef struct _HevSocks5UDPMuxClass HevSocks5UDPMuxClass;
+
+struct _HevSocks5UDPMuxPacket
+{
+    HevSocks5UDPMuxPacket *next;
+
+    unsigned short alen;
+    unsigned short len;
+    unsigned char data[];
+};
+
+struct _HevSocks5UDPMuxFlow
+{
+    HevRBTreeNode node;
+
+    int refs;
+    int nums;
+    int alen;
+    int closed;
+
+    HevTask *task;
+    HevSocks5UDPMuxPacket *head;
+    HevSocks5UDPMuxPacket *tail;
+
+    HevSocks5Addr addr;
+};
+
+/*
+ * Shares one FWD UDP session among many flows. Each flow talks to one
+ * remote address; received datagrams are queued to the flow whose address
+ * matches their source, so flows should use IP addresses rather than
+ * names. Sends from all flows are batched into vectored writes by a single
+ * pump task, which also owns the session socket once started.
+ */
+struct _HevSocks5UDPMux
+{
+    HevObject base;
+
+    int quit;
+    int nums;
+    int idle;
+
+    unsigned int drops;
+
+    HevRBTree flows;
+
+    HevTask *pump;
+    HevSocks5UDP *udp;
+    HevSocks5UDPMuxPacket *head;
+    HevSocks5UDPMuxPacket *tail;
+};
+
+struct _HevSocks5UDPMuxClass
+{
+    HevObjectClass base;
+};
+
+HevObjectClass *hev_socks5_udp_mux_class (void);
+
+int hev_socks5_udp_mux_construct (HevSocks5UDPMux *self, HevSocks5UDP *udp);
+
+HevSocks5UDPMux *hev_socks5_udp_mux_new (HevSocks5UDP *udp);
+
+/*
+ * Starts the pump task. It must be called from the task that ran the
+ * session handshake, which hands the session socket over to the pump.
+ */
+int hev_socks5_udp_mux_start (HevSocks5UDPMux *self);
+void hev_socks5_udp_mux_stop (HevSocks5UDPMux *self);
+
+/*
+ * Closing a flow wakes a task blocked in recv on it, which then fails; the
+ * flow is freed once that task has returned.
+ */
+HevSocks5UDPMuxFlow *hev_socks5_udp_mux_open (HevSocks5UDPMux *self,
+                                              const HevSocks5Addr *addr);
+void hev_socks5_udp_mux_close (HevSocks5UDPMux *self,
+                               HevSocks5UDPMuxFlow *flow);
+
+ssize_t hev_socks5_udp_mux_send (HevSocks5UDPMux *self,
+                                 HevSocks5UDPMuxFlow *flow, const void *buf,
+                                 size_t len);
+ssize_t hev_socks5_udp_mux_recv (HevSocks5UDPMux *self,
+                                 HevSocks5UDPMuxFlow *flow, void *buf,
+                                 size_t len, int timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_SOCKS5_UDP_MUX_H__ */
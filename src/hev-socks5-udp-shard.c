@@ -0,0 +1,670 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-udp-shard.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 UDP Shard
+ ============================================================================
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-io-socket.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-socks5.h"
+#include "hev-socks5-misc-priv.h"
+#include "hev-socks5-logger-priv.h"
+#include "hev-socks5-worker-priv.h"
+
+#include "hev-socks5-udp-shard.h"
+
+#define UDP_BUF_SIZE 1500
+#define RING_SIZE 64
+#define RING_MASK (RING_SIZE - 1)
+
+typedef struct _HevSocks5UDPSlot HevSocks5UDPSlot;
+typedef struct _HevSocks5UDPRing HevSocks5UDPRing;
+typedef struct _HevSocks5UDPShard HevSocks5UDPShard;
+typedef struct _HevSocks5UDPShardGroup HevSocks5UDPShardGroup;
+
+struct _HevSocks5UDPSlot
+{
+    struct sockaddr_in6 addr;
+    size_t len;
+    uint8_t buf[UDP_BUF_SIZE];
+};
+
+/*
+ * Single-producer single-consumer ring. The producer owns tail, the
+ * consumer owns head, and each side only ever reads the other index.
+ */
+struct _HevSocks5UDPRing
+{
+    unsigned int head;
+    uint8_t pad[64 - sizeof (unsigned int)];
+    unsigned int tail;
+    HevSocks5UDPSlot slots[RING_SIZE];
+};
+
+struct _HevSocks5UDPShard
+{
+    HevSocks5UDPShardGroup *group;
+
+    int fd;
+    int bound;
+    int kick[2];
+
+    HevSocks5UDPRing fwd;
+    HevSocks5UDPRing bwd;
+};
+
+struct _HevSocks5UDPShardGroup
+{
+    HevSocks5UDP *udp;
+
+    int refs;
+    int quit;
+    int nums;
+    int notify[2];
+
+    HevSocks5UDPShard shards[];
+};
+
+static unsigned int
+hev_socks5_udp_ring_used (HevSocks5UDPRing *ring)
+{
+    unsigned int head = __atomic_load_n (&ring->head, __ATOMIC_SEQ_CST);
+    unsigned int tail = __atomic_load_n (&ring->tail, __ATOMIC_SEQ_CST);
+
+    return tail - head;
+}
+
+static HevSocks5UDPSlot *
+hev_socks5_udp_ring_slot (HevSocks5UDPRing *ring, unsigned int index)
+{
+    return &ring->slots[index & RING_MASK];
+}
+
+static int
+hev_socks5_udp_ring_push (HevSocks5UDPRing *ring, unsigned int nums)
+{
+    unsigned int tail = ring->tail;
+    unsigned int head;
+
+    __atomic_store_n (&ring->tail, tail + nums, __ATOMIC_SEQ_CST);
+    head = __atomic_load_n (&ring->head, __ATOMIC_SEQ_CST);
+
+    return head == tail;
+}
+
+static int
+hev_socks5_udp_ring_pop (HevSocks5UDPRing *ring, unsigned int nums)
+{
+    unsigned int head = ring->head;
+    unsigned int tail;
+
+    __atomic_store_n (&ring->head, head + nums, __ATOMIC_SEQ_CST);
+    tail = __atomic_load_n (&ring->tail, __ATOMIC_SEQ_CST);
+
+    return (tail - head) == RING_SIZE;
+}
+
+static unsigned int
+hev_socks5_udp_shard_hash (const struct sockaddr_in6 *addr)
+{
+    const uint8_t *p = (const uint8_t *)&addr->sin6_addr;
+    unsigned int hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < 16; i++)
+        hash = (hash ^ p[i]) * 16777619u;
+
+    p = (const uint8_t *)&addr->sin6_port;
+    hash = (hash ^ p[0]) * 16777619u;
+    hash = (hash ^ p[1]) * 16777619u;
+
+    return hash;
+}
+
+static int
+hev_socks5_udp_shard_pipe (int fds[2])
+{
+    if (pipe (fds) < 0)
+        return -1;
+
+    fcntl (fds[0], F_SETFL, O_NONBLOCK);
+    fcntl (fds[1], F_SETFL, O_NONBLOCK);
+    fcntl (fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl (fds[1], F_SETFD, FD_CLOEXEC);
+
+    return 0;
+}
+
+static void
+hev_socks5_udp_shard_notify (int fd)
+{
+    char c = 0;
+
+    if (write (fd, &c, 1)) {
+        /* pipe full means the peer is already notified */
+    }
+}
+
+static void
+hev_socks5_udp_shard_drain (int fd)
+{
+    char buf[64];
+
+    while (read (fd, buf, sizeof (buf)) > 0)
+        ;
+}
+
+static void
+hev_socks5_udp_shard_group_unref (HevSocks5UDPShardGroup *group)
+{
+    int i;
+
+    if (__atomic_sub_fetch (&group->refs, 1, __ATOMIC_ACQ_REL))
+        return;
+
+    for (i = 0; i < group->nums; i++) {
+        close (group->shards[i].fd);
+        close (group->shards[i].kick[0]);
+        close (group->shards[i].kick[1]);
+    }
+
+    close (group->notify[0]);
+    close (group->notify[1]);
+    free (group);
+}
+
+static int
+hev_socks5_udp_shard_yielder (HevTaskYieldType type, void *data)
+{
+    HevSocks5UDPShard *self = data;
+
+    if (__atomic_load_n (&self->group->quit, __ATOMIC_ACQUIRE))
+        return -1;
+
+    hev_task_yield (type);
+
+    if (__atomic_load_n (&self->group->quit, __ATOMIC_ACQUIRE))
+        return -1;
+
+    return 0;
+}
+
+static int
+hev_socks5_udp_shard_send (HevSocks5UDPShard *self, int fd)
+{
+    HevSocks5UDPRing *ring = &self->fwd;
+    unsigned int i, num;
+    int res;
+
+    num = hev_socks5_udp_ring_used (ring);
+    if (!num)
+        return 0;
+
+    {
+        struct mmsghdr vec[num];
+        struct iovec iov[num];
+
+        for (i = 0; i < num; i++) {
+            HevSocks5UDPSlot *slot;
+
+            slot = hev_socks5_udp_ring_slot (ring, ring->head + i);
+            vec[i].msg_hdr.msg_name = &slot->addr;
+            vec[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_in6);
+            vec[i].msg_hdr.msg_control = NULL;
+            vec[i].msg_hdr.msg_controllen = 0;
+            vec[i].msg_hdr.msg_iov = &iov[i];
+            vec[i].msg_hdr.msg_iovlen = 1;
+            iov[i].iov_base = slot->buf;
+            iov[i].iov_len = slot->len;
+        }
+
+        res = hev_task_io_socket_sendmmsg (fd, vec, num, MSG_WAITALL,
+                                           hev_socks5_udp_shard_yielder, self);
+    }
+    if (res <= 0) {
+        LOG_D ("%p socks5 udp shard send", self);
+        return -1;
+    }
+
+    hev_socks5_udp_ring_pop (ring, res);
+
+    return 1;
+}
+
+static int
+hev_socks5_udp_shard_recv (HevSocks5UDPShard *self, int fd)
+{
+    HevSocks5UDPRing *ring = &self->bwd;
+    unsigned int i, num;
+    int res;
+
+    num = RING_SIZE - hev_socks5_udp_ring_used (ring);
+    if (!num)
+        return 0;
+
+    {
+        struct mmsghdr vec[num];
+        struct iovec iov[num];
+
+        for (i = 0; i < num; i++) {
+            HevSocks5UDPSlot *slot;
+
+            slot = hev_socks5_udp_ring_slot (ring, ring->tail + i);
+            vec[i].msg_hdr.msg_name = &slot->addr;
+            vec[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_in6);
+            vec[i].msg_hdr.msg_control = NULL;
+            vec[i].msg_hdr.msg_controllen = 0;
+            vec[i].msg_hdr.msg_iov = &iov[i];
+            vec[i].msg_hdr.msg_iovlen = 1;
+            iov[i].iov_base = slot->buf;
+            iov[i].iov_len = UDP_BUF_SIZE;
+        }
+
+        res = hev_task_io_socket_recvmmsg (fd, vec, num, MSG_DONTWAIT,
+                                           hev_socks5_udp_shard_yielder, self);
+        if (res <= 0) {
+            if (res == -1 && errno == EAGAIN)
+                return 0;
+            LOG_D ("%p socks5 udp shard recv", self);
+            return -1;
+        }
+
+        for (i = 0; i < (unsigned int)res; i++) {
+            HevSocks5UDPSlot *slot;
+
+            slot = hev_socks5_udp_ring_slot (ring, ring->tail + i);
+            slot->len = vec[i].msg_len;
+        }
+    }
+
+    if (hev_socks5_udp_ring_push (ring, res))
+        hev_socks5_udp_shard_notify (self->group->notify[1]);
+
+    return 1;
+}
+
+static void
+hev_socks5_udp_shard_exit (void *data)
+{
+    HevSocks5UDPShard *self = data;
+
+    /* a stopped shard tears the whole association down */
+    __atomic_store_n (&self->group->quit, 1, __ATOMIC_RELEASE);
+    hev_socks5_udp_shard_notify (self->group->notify[1]);
+    hev_socks5_udp_shard_group_unref (self->group);
+}
+
+static void
+hev_socks5_udp_shard_task_entry (void *data)
+{
+    HevSocks5UDPShard *self = data;
+    HevTask *task = hev_task_self ();
+    int fd = self->fd;
+    int res_s, res_r;
+
+    LOG_D ("%p socks5 udp shard task", self);
+
+    hev_task_add_fd (task, fd, POLLIN | POLLOUT);
+    hev_task_add_fd (task, self->kick[0], POLLIN);
+
+    for (;;) {
+        HevTaskYieldType type;
+
+        hev_socks5_udp_shard_drain (self->kick[0]);
+
+        res_s = hev_socks5_udp_shard_send (self, fd);
+        if (res_s < 0)
+            break;
+
+        res_r = hev_socks5_udp_shard_recv (self, fd);
+        if (res_r < 0)
+            break;
+
+        if (res_s > 0 || res_r > 0)
+            type = HEV_TASK_YIELD;
+        else
+            type = HEV_TASK_WAITIO;
+
+        if (hev_socks5_udp_shard_yielder (type, self))
+            break;
+    }
+
+    hev_task_del_fd (task, self->kick[0]);
+    hev_task_del_fd (task, fd);
+
+    hev_socks5_udp_shard_exit (self);
+}
+
+static HevSocks5UDPShardGroup *
+hev_socks5_udp_shard_group_new (HevSocks5UDP *udp, int nums)
+{
+    HevSocks5UDPShardGroup *self;
+    HevTask *task = hev_task_self ();
+    size_t size;
+    int i;
+
+    size = sizeof (HevSocks5UDPShardGroup) + sizeof (HevSocks5UDPShard) * nums;
+    self = calloc (1, size);
+    if (!self)
+        return NULL;
+
+    self->udp = udp;
+    self->refs = 1;
+
+    if (hev_socks5_udp_shard_pipe (self->notify) < 0) {
+        free (self);
+        return NULL;
+    }
+
+    for (i = 0; i < nums; i++) {
+        HevSocks5UDPShard *shard = &self->shards[i];
+
+        /* created here so the session task can bind it with its binder */
+        shard->fd = hev_socks5_socket (SOCK_DGRAM);
+        if (shard->fd < 0)
+            break;
+        hev_task_del_fd (task, shard->fd);
+
+        if (hev_socks5_udp_shard_pipe (shard->kick) < 0) {
+            close (shard->fd);
+            break;
+        }
+
+        shard->group = self;
+        self->nums++;
+    }
+
+    if (self->nums != nums) {
+        hev_socks5_udp_shard_group_unref (self);
+        return NULL;
+    }
+
+    return self;
+}
+
+static int
+hev_socks5_udp_shard_group_run (HevSocks5UDPShardGroup *self)
+{
+    int i;
+
+    for (i = 0; i < self->nums; i++) {
+        int res;
+
+        __atomic_add_fetch (&self->refs, 1, __ATOMIC_ACQ_REL);
+        res = hev_socks5_worker_spawn (hev_socks5_udp_shard_task_entry,
+                                       hev_socks5_udp_shard_exit,
+                                       &self->shards[i]);
+        if (res < 0) {
+            __atomic_sub_fetch (&self->refs, 1, __ATOMIC_ACQ_REL);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void
+hev_socks5_udp_shard_group_stop (HevSocks5UDPShardGroup *self)
+{
+    int i;
+
+    __atomic_store_n (&self->quit, 1, __ATOMIC_RELEASE);
+
+    for (i = 0; i < self->nums; i++)
+        hev_socks5_udp_shard_notify (self->shards[i].kick[1]);
+}
+
+static int
+hev_socks5_udp_shard_fwd_f (HevSocks5UDPShardGroup *self, void *buf,
+                            unsigned int num)
+{
+    HevSocks5UDPMsg msgv[num];
+    unsigned int i;
+    int res;
+
+    for (i = 0; i < num; i++) {
+        msgv[i].buf = buf + UDP_BUF_SIZE * i;
+        msgv[i].len = UDP_BUF_SIZE;
+    }
+
+    res = hev_socks5_udp_recvmmsg (self->udp, msgv, num, 1);
+    if (res <= 0) {
+        if (res == -1 && errno == EAGAIN)
+            return 0;
+        LOG_D ("%p socks5 udp shard fwd f recv", self->udp);
+        return -1;
+    }
+
+    for (i = 0; i < (unsigned int)res; i++) {
+        HevSocks5UDPShard *shard;
+        HevSocks5UDPSlot *slot;
+        struct sockaddr_in6 addr;
+        int family;
+        int ret;
+
+        if (!msgv[i].len || !msgv[i].addr) {
+            LOG_D ("%p socks5 udp shard invalid", self->udp);
+            return -1;
+        }
+
+        memset (&addr, 0, sizeof (addr));
+        family = hev_socks5_get_addr_family (HEV_SOCKS5 (self->udp));
+        ret = hev_socks5_addr_into_sockaddr6 (msgv[i].addr, &addr, &family);
+        if (ret < 0) {
+            LOG_D ("%p socks5 udp shard sockaddr", self->udp);
+            return -1;
+        }
+
+        shard = &self->shards[hev_socks5_udp_shard_hash (&addr) % self->nums];
+        if (hev_socks5_udp_ring_used (&shard->fwd) == RING_SIZE) {
+            LOG_D ("%p socks5 udp shard %p full", self->udp, shard);
+            continue;
+        }
+
+        if (!shard->bound) {
+            HevSocks5Class *skptr = HEV_OBJECT_GET_CLASS (self->udp);
+            struct sockaddr *saddr = (struct sockaddr *)&addr;
+
+            ret = skptr->binder (HEV_SOCKS5 (self->udp), shard->fd, saddr);
+            if (ret < 0) {
+                LOG_W ("%p socks5 udp shard bind", self->udp);
+                return -1;
+            }
+            shard->bound = 1;
+        }
+
+        slot = hev_socks5_udp_ring_slot (&shard->fwd, shard->fwd.tail);
+        memcpy (&slot->addr, &addr, sizeof (addr));
+        memcpy (slot->buf, msgv[i].buf, msgv[i].len);
+        slot->len = msgv[i].len;
+
+        if (hev_socks5_udp_ring_push (&shard->fwd, 1))
+            hev_socks5_udp_shard_notify (shard->kick[1]);
+    }
+
+    return 1;
+}
+
+static int
+hev_socks5_udp_shard_fwd_b (HevSocks5UDPShardGroup *self, unsigned int num)
+{
+    int i, res = 0;
+
+    hev_socks5_udp_shard_drain (self->notify[0]);
+
+    for (i = 0; i < self->nums; i++) {
+        HevSocks5UDPShard *shard = &self->shards[i];
+        HevSocks5UDPRing *ring = &shard->bwd;
+        unsigned int j, n;
+        int ret;
+
+        n = hev_socks5_udp_ring_used (ring);
+        if (!n)
+            continue;
+        if (n > num)
+            n = num;
+
+        {
+            HevSocks5UDPMsg dvec[n];
+            char saddr[n][19];
+
+            for (j = 0; j < n; j++) {
+                HevSocks5UDPSlot *slot;
+
+                slot = hev_socks5_udp_ring_slot (ring, ring->head + j);
+                dvec[j].buf = slot->buf;
+                dvec[j].len = slot->len;
+                dvec[j].addr = (HevSocks5Addr *)&saddr[j];
+                hev_socks5_addr_from_sockaddr6 (dvec[j].addr, &slot->addr);
+            }
+
+            ret = hev_socks5_udp_sendmmsg (self->udp, dvec, n);
+        }
+        if (ret <= 0) {
+            LOG_D ("%p socks5 udp shard fwd b send", self->udp);
+            return -1;
+        }
+
+        /* a full ring parks the shard until it is kicked */
+        if (hev_socks5_udp_ring_pop (ring, ret))
+            hev_socks5_udp_shard_notify (shard->kick[1]);
+        res = 1;
+    }
+
+    return res;
+}
+
+static int
+hev_socks5_udp_shard_fwd_l (HevSocks5UDPShardGroup *self, int fd,
+                            struct mmsghdr *svec, unsigned int num,
+                            HevTaskIOYielder yielder)
+{
+    int i, res;
+
+    res = hev_task_io_socket_recvmmsg (fd, svec, num, MSG_DONTWAIT, yielder,
+                                       self->udp);
+    if (res > 0) {
+        HevSocks5UDPMsg dvec[res];
+        char saddr[res][19];
+
+        for (i = 0; i < res; i++) {
+            dvec[i].buf = svec[i].msg_hdr.msg_iov->iov_base;
+            dvec[i].len = svec[i].msg_len;
+            dvec[i].addr = (HevSocks5Addr *)&saddr[i];
+            hev_socks5_addr_from_sockaddr6 (dvec[i].addr,
+                                            svec[i].msg_hdr.msg_name);
+        }
+        res = hev_socks5_udp_sendmmsg (self->udp, dvec, res);
+    }
+    if (res <= 0) {
+        if (res == -1 && errno == EAGAIN)
+            return 0;
+        LOG_D ("%p socks5 udp shard fwd l recv send", self->udp);
+        return -1;
+    }
+
+    return 1;
+}
+
+int
+hev_socks5_udp_shard_splice (HevSocks5UDP *self, int fd_b, int nums,
+                             HevTaskIOYielder yielder)
+{
+    HevSocks5UDPShardGroup *group;
+    HevTask *task = hev_task_self ();
+    int res_f = 1, res_b = 1, res_l = 1;
+    void *buf;
+    int num;
+    int fd;
+
+    LOG_D ("%p socks5 udp shard splice %d", self, nums);
+
+    group = hev_socks5_udp_shard_group_new (self, nums);
+    if (!group)
+        return -1;
+
+    num = hev_socks5_get_udp_copy_buffer_nums ();
+    buf = hev_malloc (UDP_BUF_SIZE * num * 2);
+    if (!buf) {
+        hev_socks5_udp_shard_group_unref (group);
+        return -1;
+    }
+
+    if (hev_socks5_udp_shard_group_run (group) < 0) {
+        hev_socks5_udp_shard_group_stop (group);
+        hev_socks5_udp_shard_group_unref (group);
+        hev_free (buf);
+        return -1;
+    }
+
+    fd = hev_socks5_udp_get_fd (self);
+    if (hev_task_mod_fd (task, fd, POLLIN | POLLOUT) < 0)
+        hev_task_add_fd (task, fd, POLLIN | POLLOUT);
+    hev_task_add_fd (task, group->notify[0], POLLIN);
+
+    {
+        struct mmsghdr vec[num];
+        struct sockaddr_in6 addr[num];
+        struct iovec iov[num];
+        int i;
+
+        for (i = 0; i < num; i++) {
+            vec[i].msg_hdr.msg_name = (struct sockaddr *)&addr[i];
+            vec[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_in6);
+            vec[i].msg_hdr.msg_control = NULL;
+            vec[i].msg_hdr.msg_controllen = 0;
+            vec[i].msg_hdr.msg_iov = &iov[i];
+            vec[i].msg_hdr.msg_iovlen = 1;
+            iov[i].iov_base = buf + UDP_BUF_SIZE * (num + i);
+            iov[i].iov_len = UDP_BUF_SIZE;
+        }
+
+        for (;;) {
+            HevTaskYieldType type;
+
+            if (res_f >= 0)
+                res_f = hev_socks5_udp_shard_fwd_f (group, buf, num);
+            if (res_b >= 0)
+                res_b = hev_socks5_udp_shard_fwd_b (group, num);
+            /* late replies to flows sent before the split */
+            if (res_l >= 0)
+                res_l = hev_socks5_udp_shard_fwd_l (group, fd_b, vec, num,
+                                                    yielder);
+
+            if (res_f > 0 || res_b > 0 || res_l > 0)
+                type = HEV_TASK_YIELD;
+            else if ((res_f & res_b) == 0)
+                type = HEV_TASK_WAITIO;
+            else
+                break;
+
+            if (__atomic_load_n (&group->quit, __ATOMIC_ACQUIRE))
+                break;
+
+            if (yielder (type, self))
+                break;
+        }
+    }
+
+    hev_task_del_fd (task, group->notify[0]);
+    hev_free (buf);
+
+    /* shards never touch the session, the last one out frees the group */
+    hev_socks5_udp_shard_group_stop (group);
+    hev_socks5_udp_shard_group_unref (group);
+
+    return 0;
+}
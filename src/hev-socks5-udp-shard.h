@@ -0,0 +1,28 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-udp-shard.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 UDP Shard
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_UDP_SHARD_H__
+#define __HEV_SOCKS5_UDP_SHARD_H__
+
+#include <hev-task-io.h>
+
+#include "hev-socks5-udp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int hev_socks5_udp_shard_splice (HevSocks5UDP *self, int fd_b, int nums,
+                                 HevTaskIOYielder yielder);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_SOCKS5_UDP_SHARD_H__ */
@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-socks5-udp.c
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2021 - 2025 hev
+ Copyright   : Copyright (c) 2021 - 2026 hev
  Description : Socks5 UDP
  ============================================================================
  */
@@ -20,11 +20,20 @@
 #include "hev-socks5.h"
 #include "hev-socks5-misc-priv.h"
 #include "hev-socks5-logger-priv.h"
+#include "hev-socks5-udp-shard.h"
 
 #include "hev-socks5-udp.h"
 
 #define UDP_BUF_SIZE 1500
 
+typedef struct _HevSocks5UDPTemplate HevSocks5UDPTemplate;
+
+struct _HevSocks5UDPTemplate
+{
+    unsigned int len;
+    unsigned char hdr[];
+};
+
 static int
 task_io_yielder (HevTaskYieldType type, void *data)
 {
@@ -53,15 +62,51 @@ hev_socks5_udp_get_fd (HevSocks5UDP *self)
     return iface->get_fd (self);
 }
 
+int
+hev_socks5_udp_connect (HevSocks5UDP *self, const HevSocks5Addr *addr)
+{
+    HevSocks5UDPTemplate *tpl = NULL;
+    int addrlen;
+
+    LOG_D ("%p socks5 udp connect", self);
+
+    if (addr) {
+        addrlen = hev_socks5_addr_len (addr);
+        if (addrlen <= 0) {
+            LOG_D ("%p socks5 udp addr", self);
+            return -1;
+        }
+
+        tpl = hev_malloc (sizeof (HevSocks5UDPTemplate) + 3 + addrlen);
+        if (!tpl)
+            return -1;
+
+        tpl->len = 3 + addrlen;
+        tpl->hdr[0] = 0;
+        tpl->hdr[1] = 0;
+        tpl->hdr[2] = 0;
+        memcpy (tpl->hdr + 3, addr, addrlen);
+    }
+
+    if (HEV_SOCKS5 (self)->udp_tpl)
+        hev_free (HEV_SOCKS5 (self)->udp_tpl);
+    HEV_SOCKS5 (self)->udp_tpl = tpl;
+
+    return 0;
+}
+
 static int
 hev_socks5_udp_sendmmsg_tcp (HevSocks5UDP *self, HevSocks5UDPMsg *msgv,
                              unsigned int num)
 {
+    HevSocks5UDPTemplate *tpl;
     struct iovec iov[num * 3];
     HevSocks5UDPHdr udp[num];
     struct msghdr mh;
     int i, res;
 
+    tpl = HEV_SOCKS5 (self)->udp_tpl;
+
     mh.msg_name = NULL;
     mh.msg_namelen = 0;
     mh.msg_control = NULL;
@@ -70,12 +115,18 @@ hev_socks5_udp_sendmmsg_tcp (HevSocks5UDP *self, HevSocks5UDPMsg *msgv,
     mh.msg_iovlen = num * 3;
 
     for (i = 0; i < num; i++) {
+        void *addr = msgv[i].addr;
         int addrlen;
 
-        addrlen = hev_socks5_addr_len (msgv[i].addr);
-        if (addrlen <= 0) {
-            LOG_D ("%p socks5 udp addr", self);
-            return -1;
+        if (!addr && tpl) {
+            addr = tpl->hdr + 3;
+            addrlen = tpl->len - 3;
+        } else {
+            addrlen = hev_socks5_addr_len (addr);
+            if (addrlen <= 0) {
+                LOG_D ("%p socks5 udp addr", self);
+                return -1;
+            }
         }
 
         udp[i].datlen = htons (msgv[i].len);
@@ -83,7 +134,7 @@ hev_socks5_udp_sendmmsg_tcp (HevSocks5UDP *self, HevSocks5UDPMsg *msgv,
 
         iov[i * 3].iov_base = &udp[i];
         iov[i * 3].iov_len = 3;
-        iov[i * 3 + 1].iov_base = msgv[i].addr;
+        iov[i * 3 + 1].iov_base = addr;
         iov[i * 3 + 1].iov_len = addrlen;
         iov[i * 3 + 2].iov_base = msgv[i].buf;
         iov[i * 3 + 2].iov_len = msgv[i].len;
@@ -103,14 +154,33 @@ static int
 hev_socks5_udp_sendmmsg_udp (HevSocks5UDP *self, HevSocks5UDPMsg *msgv,
                              unsigned int num)
 {
+    HevSocks5UDPTemplate *tpl;
     struct iovec iov[num * 3];
     struct mmsghdr mvec[num];
     HevSocks5UDPHdr udp[num];
     int i, res;
 
+    tpl = HEV_SOCKS5 (self)->udp_tpl;
+
     for (i = 0; i < num; i++) {
         int addrlen;
 
+        mvec[i].msg_hdr.msg_name = NULL;
+        mvec[i].msg_hdr.msg_namelen = 0;
+        mvec[i].msg_hdr.msg_control = NULL;
+        mvec[i].msg_hdr.msg_controllen = 0;
+        mvec[i].msg_hdr.msg_iov = &iov[i * 3];
+
+        /* connected: the whole header comes from the cached template */
+        if (!msgv[i].addr && tpl) {
+            iov[i * 3].iov_base = tpl->hdr;
+            iov[i * 3].iov_len = tpl->len;
+            iov[i * 3 + 1].iov_base = msgv[i].buf;
+            iov[i * 3 + 1].iov_len = msgv[i].len;
+            mvec[i].msg_hdr.msg_iovlen = 2;
+            continue;
+        }
+
         addrlen = hev_socks5_addr_len (msgv[i].addr);
         if (addrlen <= 0) {
             LOG_D ("%p socks5 udp addr", self);
@@ -126,12 +196,6 @@ hev_socks5_udp_sendmmsg_udp (HevSocks5UDP *self, HevSocks5UDPMsg *msgv,
         iov[i * 3 + 1].iov_len = addrlen;
         iov[i * 3 + 2].iov_base = msgv[i].buf;
         iov[i * 3 + 2].iov_len = msgv[i].len;
-
-        mvec[i].msg_hdr.msg_name = NULL;
-        mvec[i].msg_hdr.msg_namelen = 0;
-        mvec[i].msg_hdr.msg_control = NULL;
-        mvec[i].msg_hdr.msg_controllen = 0;
-        mvec[i].msg_hdr.msg_iov = &iov[i * 3];
         mvec[i].msg_hdr.msg_iovlen = 3;
     }
 
@@ -235,6 +299,7 @@ static int
 hev_socks5_udp_recvmmsg_udp (HevSocks5UDP *self, HevSocks5UDPMsg *msgv,
                              unsigned int num, int nonblock)
 {
+    HevSocks5UDPTemplate *tpl;
     struct sockaddr_in6 taddr;
     struct mmsghdr mvec[num];
     struct iovec iov[num];
@@ -278,9 +343,12 @@ hev_socks5_udp_recvmmsg_udp (HevSocks5UDP *self, HevSocks5UDPMsg *msgv,
         HEV_SOCKS5 (self)->udp_associated = 1;
     }
 
+    tpl = HEV_SOCKS5 (self)->udp_tpl;
+
     for (i = 0; i < res; i++) {
         HevSocks5UDPHdr *udp = msgv[i].buf;
-        int addrlen = hev_socks5_addr_len (&udp->addr);
+        unsigned int hlen = tpl ? tpl->len : 0;
+        int addrlen;
         int doff;
 
         msgv[i].len = mvec[i].msg_len;
@@ -290,6 +358,15 @@ hev_socks5_udp_recvmmsg_udp (HevSocks5UDP *self, HevSocks5UDPMsg *msgv,
             continue;
         }
 
+        if (hlen && msgv[i].len >= hlen &&
+            !memcmp (udp, tpl->hdr, hlen)) {
+            msgv[i].addr = &udp->addr;
+            msgv[i].buf += hlen;
+            msgv[i].len -= hlen;
+            continue;
+        }
+
+        addrlen = hev_socks5_addr_len (&udp->addr);
         if (addrlen <= 0) {
             LOG_D ("%p socks5 udp addr", self);
             return -1;
@@ -390,7 +467,7 @@ hev_socks5_udp_fwd_f (HevSocks5UDP *self, int fd, void *buf, unsigned int num,
         return -1;
     }
 
-    return 1;
+    return res;
 }
 
 static int
@@ -429,13 +506,17 @@ hev_socks5_udp_splicer (HevSocks5UDP *self, int fd_b)
 {
     HevTask *task = hev_task_self ();
     int res_f = 1, res_b = 1;
+    int64_t stamp = 0;
     int bind = 0;
+    int hot = 0;
     void *buf;
+    int shard;
     int fd_a;
     int num;
 
     LOG_D ("%p socks5 udp splicer", self);
 
+    shard = hev_socks5_get_udp_shard_nums ();
     num = hev_socks5_get_udp_copy_buffer_nums ();
     buf = hev_malloc (UDP_BUF_SIZE * num * 2);
     if (!buf)
@@ -472,6 +553,24 @@ hev_socks5_udp_splicer (HevSocks5UDP *self, int fd_b)
             if (res_b >= 0)
                 res_b = hev_socks5_udp_fwd_b (self, fd_b, vec, num);
 
+            /* only elephant associations are worth splitting into shards */
+            if (shard > 1 && res_f > 0) {
+                int64_t now = hev_socks5_now ();
+
+                if ((now - stamp) >= 1000) {
+                    stamp = now;
+                    hot = 0;
+                }
+                hot += res_f;
+                if (hot >= hev_socks5_get_udp_shard_rate ()) {
+                    if (!hev_socks5_udp_shard_splice (self, fd_b, shard,
+                                                      task_io_yielder))
+                        break;
+                    LOG_W ("%p socks5 udp shard splice", self);
+                    shard = 0;
+                }
+            }
+
             if (res_f > 0 || res_b > 0)
                 type = HEV_TASK_YIELD;
             else if ((res_f & res_b) == 0)
@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-socks5-udp.h
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2021 - 2025 hev
+ Copyright   : Copyright (c) 2021 - 2026 hev
  Description : Socks5 UDP
  ============================================================================
  */
@@ -41,6 +41,13 @@ void *hev_socks5_udp_iface (void);
 
 int hev_socks5_udp_get_fd (HevSocks5UDP *self);
 
+/*
+ * Fixes the destination of messages sent with a NULL addr. The encoded
+ * header is cached, and UDP-in-UDP datagrams from that address skip the
+ * per-message address parsing on receive. A NULL addr drops the cache.
+ */
+int hev_socks5_udp_connect (HevSocks5UDP *self, const HevSocks5Addr *addr);
+
 int hev_socks5_udp_sendmmsg (HevSocks5UDP *self, HevSocks5UDPMsg *msgv,
                              unsigned int num);
 int hev_socks5_udp_recvmmsg (HevSocks5UDP *self, HevSocks5UDPMsg *msgv,
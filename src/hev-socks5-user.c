@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-socks5-user.c
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2023 hev
+ Copyright   : Copyright (c) 2023 - 2026 hev
  Description : Socks5 User
  ============================================================================
  */
@@ -45,6 +45,13 @@ hev_socks5_user_check (HevSocks5User *self, const char *pass,
     return klass->checker (self, pass, pass_len);
 }
 
+void
+hev_socks5_user_set_profile (HevSocks5User *self,
+                             const HevSocks5SocketProfile *profile)
+{
+    self->profile = profile;
+}
+
 static int
 hev_socks5_user_checker (HevSocks5User *self, const char *pass,
                          unsigned int pass_len)
@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-socks5-user.h
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2023 hev
+ Copyright   : Copyright (c) 2023 - 2026 hev
  Description : Socks5 User
  ============================================================================
  */
@@ -13,6 +13,7 @@
 #include <hev-object-atomic.h>
 
 #include "hev-rbtree.h"
+#include "hev-socks5-misc.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -35,6 +36,8 @@ struct _HevSocks5User
     char *pass;
     unsigned int name_len;
     unsigned int pass_len;
+
+    const HevSocks5SocketProfile *profile;
 };
 
 struct _HevSocks5UserClass
@@ -57,6 +60,9 @@ HevSocks5User *hev_socks5_user_new (const char *name, unsigned int name_len,
 int hev_socks5_user_check (HevSocks5User *self, const char *pass,
                            unsigned int pass_len);
 
+void hev_socks5_user_set_profile (HevSocks5User *self,
+                                  const HevSocks5SocketProfile *profile);
+
 #ifdef __cplusplus
 }
 #endif
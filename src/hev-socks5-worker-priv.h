@@ -0,0 +1,33 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-worker-priv.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Worker Private
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_WORKER_PRIV_H__
+#define __HEV_SOCKS5_WORKER_PRIV_H__
+
+#include <hev-task.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*HevSocks5WorkerDrop) (void *data);
+
+/*
+ * Runs entry in a new task on the next thread of a fixed pool shared by
+ * all sessions, started on first use. If the worker cannot create the
+ * task, drop is called with data on that thread instead.
+ */
+int hev_socks5_worker_spawn (HevTaskEntry entry, HevSocks5WorkerDrop drop,
+                             void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_SOCKS5_WORKER_PRIV_H__ */
@@ -0,0 +1,213 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-worker.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Worker
+ ============================================================================
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <hev-task.h>
+#include <hev-task-system.h>
+
+#include "hev-socks5-misc-priv.h"
+#include "hev-socks5-logger-priv.h"
+
+#include "hev-socks5-worker-priv.h"
+
+typedef struct _HevSocks5Worker HevSocks5Worker;
+typedef struct _HevSocks5WorkerJob HevSocks5WorkerJob;
+
+struct _HevSocks5WorkerJob
+{
+    HevSocks5WorkerJob *next;
+    HevTaskEntry entry;
+    HevSocks5WorkerDrop drop;
+    void *data;
+};
+
+struct _HevSocks5Worker
+{
+    pthread_mutex_t lock;
+    HevSocks5WorkerJob *jobs;
+    int fds[2];
+    int ready;
+};
+
+static pthread_mutex_t workers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workers_cond = PTHREAD_COND_INITIALIZER;
+static HevSocks5Worker *workers;
+static unsigned int worker_next;
+static int worker_nums;
+
+static void
+hev_socks5_worker_task_entry (void *data)
+{
+    HevSocks5Worker *self = data;
+    HevTask *task = hev_task_self ();
+
+    hev_task_add_fd (task, self->fds[0], POLLIN);
+
+    for (;;) {
+        HevSocks5WorkerJob *job;
+        char buf[64];
+
+        while (read (self->fds[0], buf, sizeof (buf)) > 0)
+            ;
+
+        pthread_mutex_lock (&self->lock);
+        job = self->jobs;
+        self->jobs = NULL;
+        pthread_mutex_unlock (&self->lock);
+
+        if (!job) {
+            hev_task_yield (HEV_TASK_WAITIO);
+            continue;
+        }
+
+        while (job) {
+            HevSocks5WorkerJob *next = job->next;
+
+            task = hev_task_new (hev_socks5_get_task_stack_size ());
+            if (task) {
+                hev_task_run (task, job->entry, job->data);
+            } else {
+                LOG_W ("%p socks5 worker task", self);
+                job->drop (job->data);
+            }
+
+            free (job);
+            job = next;
+        }
+    }
+}
+
+static void *
+hev_socks5_worker_thread (void *data)
+{
+    HevSocks5Worker *self = data;
+    HevTask *task = NULL;
+
+    if (hev_task_system_init () == 0) {
+        task = hev_task_new (-1);
+        if (task)
+            hev_task_run (task, hev_socks5_worker_task_entry, self);
+        else
+            hev_task_system_fini ();
+    }
+
+    pthread_mutex_lock (&workers_lock);
+    self->ready = task ? 1 : -1;
+    pthread_cond_broadcast (&workers_cond);
+    pthread_mutex_unlock (&workers_lock);
+
+    if (task) {
+        hev_task_system_run ();
+        hev_task_system_fini ();
+    }
+
+    return NULL;
+}
+
+static int
+hev_socks5_worker_start (void)
+{
+    pthread_attr_t attr;
+    int nums;
+    int i;
+
+    nums = hev_socks5_get_worker_nums ();
+    workers = calloc (nums, sizeof (HevSocks5Worker));
+    if (!workers)
+        return -1;
+
+    pthread_attr_init (&attr);
+    pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+
+    for (i = 0; i < nums; i++) {
+        HevSocks5Worker *worker = &workers[i];
+        pthread_t thread;
+
+        if (pipe (worker->fds) < 0)
+            break;
+        fcntl (worker->fds[0], F_SETFL, O_NONBLOCK);
+        fcntl (worker->fds[1], F_SETFL, O_NONBLOCK);
+        fcntl (worker->fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl (worker->fds[1], F_SETFD, FD_CLOEXEC);
+        pthread_mutex_init (&worker->lock, NULL);
+
+        if (pthread_create (&thread, &attr, hev_socks5_worker_thread,
+                            worker) == 0) {
+            /* called with workers_lock held, which the thread takes */
+            while (!worker->ready)
+                pthread_cond_wait (&workers_cond, &workers_lock);
+        }
+        if (worker->ready <= 0) {
+            close (worker->fds[0]);
+            close (worker->fds[1]);
+            break;
+        }
+    }
+
+    pthread_attr_destroy (&attr);
+
+    if (i == 0) {
+        free (workers);
+        workers = NULL;
+        return -1;
+    }
+
+    LOG_I ("socks5 worker threads %d", i);
+    __atomic_store_n (&worker_nums, i, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+int
+hev_socks5_worker_spawn (HevTaskEntry entry, HevSocks5WorkerDrop drop,
+                         void *data)
+{
+    HevSocks5WorkerJob *job;
+    HevSocks5Worker *worker;
+    unsigned int index;
+    int nums;
+    char c = 0;
+
+    nums = __atomic_load_n (&worker_nums, __ATOMIC_ACQUIRE);
+    if (!nums) {
+        pthread_mutex_lock (&workers_lock);
+        nums = worker_nums;
+        if (!nums && hev_socks5_worker_start () == 0)
+            nums = worker_nums;
+        pthread_mutex_unlock (&workers_lock);
+        if (!nums)
+            return -1;
+    }
+
+    job = malloc (sizeof (HevSocks5WorkerJob));
+    if (!job)
+        return -1;
+
+    job->entry = entry;
+    job->drop = drop;
+    job->data = data;
+
+    index = __atomic_fetch_add (&worker_next, 1, __ATOMIC_RELAXED);
+    worker = &workers[index % nums];
+
+    pthread_mutex_lock (&worker->lock);
+    job->next = worker->jobs;
+    worker->jobs = job;
+    pthread_mutex_unlock (&worker->lock);
+
+    if (write (worker->fds[1], &c, 1)) {
+        /* pipe full means the worker is already woken */
+    }
+
+    return 0;
+}
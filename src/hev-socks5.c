@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-socks5.c
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2021 - 2023 hev
+ Copyright   : Copyright (c) 2021 - 2026 hev
  Description : Socks5
  ============================================================================
  */
@@ -86,6 +86,9 @@ hev_socks5_destruct (HevObject *base)
         close (self->fd);
     }
 
+    if (self->udp_tpl)
+        hev_free (self->udp_tpl);
+
     HEV_OBJECT_TYPE->destruct (base);
     hev_free (base);
 }
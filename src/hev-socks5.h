@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-socks5.h
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2021 - 2023 hev
+ Copyright   : Copyright (c) 2021 - 2026 hev
  Description : Socks5
  ============================================================================
  */
@@ -52,6 +52,8 @@ struct _HevSocks5
     unsigned int type : 2;
     unsigned int udp_associated : 1;
     HevSocks5AddrFamily addr_family;
+
+    void *udp_tpl;
 };
 
 struct _HevSocks5Class
@@ -0,0 +1,153 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-admission-test.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Admission Test
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <hev-task.h>
+#include <hev-task-system.h>
+
+#include "hev-socks5.h"
+#include "hev-socks5-misc.h"
+#include "hev-socks5-misc-priv.h"
+#include "hev-socks5-admission-priv.h"
+
+/*
+ * Sessions are accepted from a listener on [::ffff:127.0.0.1], so every
+ * peer shares one rate bucket. Unix socket pairs have no peer address and
+ * only count against the handshake cap.
+ */
+
+static int fails;
+static int lfd;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            fprintf (stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);    \
+            fails++;                                                       \
+        }                                                                  \
+    } while (0)
+
+static int
+peer_accept (int *cfd)
+{
+    struct sockaddr_in6 addr;
+    socklen_t alen = sizeof (addr);
+
+    *cfd = socket (AF_INET6, SOCK_STREAM, 0);
+    if (*cfd < 0 || getsockname (lfd, (struct sockaddr *)&addr, &alen) < 0 ||
+        connect (*cfd, (struct sockaddr *)&addr, alen) < 0)
+        return -1;
+
+    return accept (lfd, NULL, NULL);
+}
+
+static void
+test_entry (void *data)
+{
+    unsigned int handshakes, over_limit, over_rate;
+    int fds[3], cfds[3], ufds[4][2];
+    int i;
+
+    CHECK (hev_socks5_set_client_rate_limit (100, 100, 64) < 0);
+
+    for (i = 0; i < 3; i++) {
+        fds[i] = peer_accept (&cfds[i]);
+        CHECK (fds[i] >= 0);
+    }
+
+    /* a burst of two, whatever the source port */
+    CHECK (hev_socks5_admission_enter (fds[0]) == 0);
+    hev_socks5_admission_leave ();
+    CHECK (hev_socks5_admission_enter (fds[1]) == 0);
+    hev_socks5_admission_leave ();
+    CHECK (hev_socks5_admission_enter (fds[2]) < 0);
+    CHECK (hev_socks5_admission_enter (fds[0]) < 0);
+
+    /* two per second refill one token in half a second */
+    hev_task_sleep (600);
+    CHECK (hev_socks5_admission_enter (fds[2]) == 0);
+    hev_socks5_admission_leave ();
+    CHECK (hev_socks5_admission_enter (fds[2]) < 0);
+
+    /* handshakes in flight are capped at three */
+    for (i = 0; i < 4; i++)
+        CHECK (socketpair (AF_UNIX, SOCK_STREAM, 0, ufds[i]) == 0);
+    for (i = 0; i < 3; i++)
+        CHECK (hev_socks5_admission_enter (ufds[i][0]) == 0);
+    CHECK (hev_socks5_admission_enter (ufds[3][0]) < 0);
+
+    hev_socks5_get_admission_stats (&handshakes, &over_limit, &over_rate);
+    CHECK (handshakes == 3);
+    CHECK (over_limit == 1);
+    CHECK (over_rate == 3);
+
+    hev_socks5_admission_leave ();
+    CHECK (hev_socks5_admission_enter (ufds[3][0]) == 0);
+    for (i = 0; i < 3; i++)
+        hev_socks5_admission_leave ();
+
+    hev_socks5_get_admission_stats (&handshakes, &over_limit, &over_rate);
+    CHECK (handshakes == 0);
+
+    for (i = 0; i < 3; i++) {
+        close (fds[i]);
+        close (cfds[i]);
+    }
+    for (i = 0; i < 4; i++) {
+        close (ufds[i][0]);
+        close (ufds[i][1]);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+    struct sockaddr_in6 addr = { 0 };
+    HevTask *task;
+    int zero = 0;
+
+    lfd = socket (AF_INET6, SOCK_STREAM, 0);
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr.s6_addr[10] = 0xff;
+    addr.sin6_addr.s6_addr[11] = 0xff;
+    inet_pton (AF_INET, "127.0.0.1", &addr.sin6_addr.s6_addr[12]);
+    if (lfd < 0 ||
+        setsockopt (lfd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof (zero)) ||
+        bind (lfd, (struct sockaddr *)&addr, sizeof (addr)) < 0 ||
+        listen (lfd, 8) < 0) {
+        perror ("listener");
+        return 1;
+    }
+
+    hev_socks5_set_handshake_limit (3);
+    if (hev_socks5_set_client_rate_limit (2, 2, 64)) {
+        fprintf (stderr, "client rate limit\n");
+        return 1;
+    }
+
+    hev_task_system_init ();
+    task = hev_task_new (-1);
+    hev_task_run (task, test_entry, NULL);
+    hev_task_system_run ();
+    hev_task_system_fini ();
+
+    close (lfd);
+
+    if (fails)
+        return 1;
+
+    printf ("admission: ok\n");
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-breaker-test.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Breaker Test
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <hev-task.h>
+#include <hev-task-system.h>
+
+#include "hev-socks5.h"
+#include "hev-socks5-misc.h"
+#include "hev-socks5-misc-priv.h"
+#include "hev-socks5-breaker-priv.h"
+
+/*
+ * The breaker trips after two failures in a row, backs off for 200 ms and
+ * allows two connects pending per destination.
+ */
+
+static int fails;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            fprintf (stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);    \
+            fails++;                                                       \
+        }                                                                  \
+    } while (0)
+
+static void
+name_key (const char *name, int port, struct sockaddr_in6 *key)
+{
+    HevSocks5Addr addr;
+    int len = strlen (name);
+
+    addr.atype = HEV_SOCKS5_ADDR_TYPE_NAME;
+    addr.domain.len = len;
+    memcpy (addr.domain.addr, name, len);
+    addr.domain.addr[len] = port >> 8;
+    addr.domain.addr[len + 1] = port;
+
+    hev_socks5_breaker_key (&addr, key);
+}
+
+static void
+ipv4_key (const char *str, int port, struct sockaddr_in6 *key)
+{
+    HevSocks5Addr addr;
+
+    addr.atype = HEV_SOCKS5_ADDR_TYPE_IPV4;
+    inet_pton (AF_INET, str, addr.ipv4.addr);
+    addr.ipv4.port = htons (port);
+
+    hev_socks5_breaker_key (&addr, key);
+}
+
+static void
+sockaddr (const char *str, int port, struct sockaddr_in6 *saddr)
+{
+    memset (saddr, 0, sizeof (struct sockaddr_in6));
+    saddr->sin6_family = AF_INET6;
+    saddr->sin6_port = htons (port);
+    saddr->sin6_addr.s6_addr[10] = 0xff;
+    saddr->sin6_addr.s6_addr[11] = 0xff;
+    inet_pton (AF_INET, str, &saddr->sin6_addr.s6_addr[12]);
+}
+
+static int
+same (const struct sockaddr_in6 *a, const struct sockaddr_in6 *b)
+{
+    return a->sin6_port == b->sin6_port &&
+           memcmp (&a->sin6_addr, &b->sin6_addr, 16) == 0;
+}
+
+static void
+fail_name (const struct sockaddr_in6 *key, const struct sockaddr_in6 *addrs)
+{
+    CHECK (hev_socks5_breaker_enter (key) == 0);
+    hev_socks5_breaker_leave (key, NULL, addrs, 2);
+}
+
+static void
+test_entry (void *data)
+{
+    struct sockaddr_in6 name, other, lit, addrs[2];
+    unsigned int trips, rejects;
+
+    CHECK (hev_socks5_set_connect_breaker (5, 1000, 0, 64) < 0);
+
+    /* names are keyed case-insensitively, with their port */
+    name_key ("Example.test", 443, &name);
+    name_key ("example.test", 443, &other);
+    CHECK (same (&name, &other));
+    name_key ("example.test", 80, &other);
+    CHECK (!same (&name, &other));
+
+    /* IP literals are keyed as the address they connect to */
+    ipv4_key ("192.0.2.1", 443, &lit);
+    sockaddr ("192.0.2.1", 443, &addrs[0]);
+    sockaddr ("192.0.2.2", 443, &addrs[1]);
+    CHECK (same (&lit, &addrs[0]));
+
+    /* connects pending to one destination are capped */
+    CHECK (hev_socks5_breaker_enter (&name) == 0);
+    CHECK (hev_socks5_breaker_enter (&name) == 0);
+    CHECK (hev_socks5_breaker_enter (&name) < 0);
+    hev_socks5_breaker_cancel (&name);
+    hev_socks5_breaker_cancel (&name);
+
+    /* a name failing on every address charges each of them */
+    fail_name (&name, addrs);
+    fail_name (&name, addrs);
+    CHECK (hev_socks5_breaker_enter (&name) < 0);
+    CHECK (hev_socks5_breaker_enter (&lit) < 0);
+    CHECK (hev_socks5_breaker_enter (&addrs[1]) < 0);
+
+    /* after the backoff one probe goes through at a time */
+    hev_task_sleep (250);
+    CHECK (hev_socks5_breaker_enter (&name) == 0);
+    CHECK (hev_socks5_breaker_enter (&name) < 0);
+
+    /* its success closes the name and credits the address that won */
+    hev_socks5_breaker_leave (&name, &addrs[1], NULL, 0);
+    CHECK (hev_socks5_breaker_enter (&name) == 0);
+    hev_socks5_breaker_cancel (&name);
+    CHECK (hev_socks5_breaker_enter (&addrs[1]) == 0);
+    CHECK (hev_socks5_breaker_enter (&addrs[1]) == 0);
+    hev_socks5_breaker_cancel (&addrs[1]);
+    hev_socks5_breaker_cancel (&addrs[1]);
+
+    /* the other address still waits for a probe of its own */
+    CHECK (hev_socks5_breaker_enter (&lit) == 0);
+    CHECK (hev_socks5_breaker_enter (&lit) < 0);
+    hev_socks5_breaker_leave (&lit, NULL, NULL, 0);
+    CHECK (hev_socks5_breaker_enter (&lit) < 0);
+
+    hev_socks5_get_connect_breaker_stats (&trips, &rejects);
+    CHECK (trips == 4);
+    CHECK (rejects == 7);
+}
+
+int
+main (int argc, char *argv[])
+{
+    HevTask *task;
+
+    if (hev_socks5_set_connect_breaker (2, 200, 2, 64)) {
+        fprintf (stderr, "connect breaker\n");
+        return 1;
+    }
+
+    hev_task_system_init ();
+    task = hev_task_new (-1);
+    hev_task_run (task, test_entry, NULL);
+    hev_task_system_run ();
+    hev_task_system_fini ();
+
+    if (fails)
+        return 1;
+
+    printf ("breaker: ok\n");
+    return 0;
+}
@@ -0,0 +1,265 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-dns-cache-test.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 DNS Cache Test
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <hev-task.h>
+#include <hev-task-system.h>
+
+#include "hev-socks5.h"
+#include "hev-socks5-misc.h"
+#include "hev-socks5-misc-priv.h"
+
+/*
+ * A fake nameserver on 127.0.0.1 counts the queries for each name and
+ * answers A queries by name:
+ *   one.test  192.0.2.1 (TTL 60)
+ *   slow.test 192.0.2.2 (TTL 60), 100 ms late
+ *   nx.test   NXDOMAIN
+ *   lost.test never answered
+ */
+
+enum
+{
+    NAME_ONE,
+    NAME_SLOW,
+    NAME_NX,
+    NAME_LOST,
+    NAME_MAX,
+};
+
+static const char *names[NAME_MAX] = {
+    "one.test",
+    "slow.test",
+    "nx.test",
+    "lost.test",
+};
+
+static int fails;
+static int joined;
+static unsigned int queries[NAME_MAX];
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            fprintf (stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);    \
+            fails++;                                                       \
+        }                                                                  \
+    } while (0)
+
+static int
+fake_name (const uint8_t *buf, int len, char *name, int size)
+{
+    int off = 12;
+    int n = 0;
+
+    while (off < len && buf[off]) {
+        int l = buf[off++];
+
+        if (off + l > len || n + l + 1 >= size)
+            return -1;
+        if (n)
+            name[n++] = '.';
+        memcpy (&name[n], &buf[off], l);
+        n += l;
+        off += l;
+    }
+
+    name[n] = '\0';
+    return (off + 5 <= len) ? off + 5 : -1;
+}
+
+static int
+fake_answer (uint8_t *buf, int off, const char *addr)
+{
+    buf[off++] = 0xc0; /* pointer to the question name */
+    buf[off++] = 12;
+    buf[off++] = 0;
+    buf[off++] = 1;
+    buf[off++] = 0;
+    buf[off++] = 1;
+    buf[off++] = 0;
+    buf[off++] = 0;
+    buf[off++] = 0;
+    buf[off++] = 60;
+    buf[off++] = 0;
+    buf[off++] = 4;
+    inet_pton (AF_INET, addr, &buf[off]);
+
+    return off + 4;
+}
+
+static void *
+fake_server (void *data)
+{
+    int fd = *(int *)data;
+
+    for (;;) {
+        struct sockaddr_in from;
+        socklen_t flen = sizeof (from);
+        uint8_t buf[512];
+        char name[256];
+        int len, off, type, i;
+
+        len = recvfrom (fd, buf, sizeof (buf), 0, (struct sockaddr *)&from,
+                        &flen);
+        if (len < 12)
+            continue;
+
+        off = fake_name (buf, len, name, sizeof (name));
+        if (off < 0)
+            continue;
+        type = (buf[off - 4] << 8) | buf[off - 3];
+
+        for (i = 0; i < NAME_MAX; i++)
+            if (strcmp (name, names[i]) == 0)
+                break;
+        if (i == NAME_MAX || i == NAME_LOST) {
+            if (i == NAME_LOST)
+                __atomic_add_fetch (&queries[i], 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (type == 1)
+            __atomic_add_fetch (&queries[i], 1, __ATOMIC_RELAXED);
+
+        buf[2] = 0x81; /* response, recursion desired */
+        buf[3] = 0x80; /* recursion available */
+        buf[6] = 0;
+        buf[7] = 0;
+
+        if (i == NAME_NX) {
+            buf[3] |= 3;
+        } else if (type == 1) {
+            if (i == NAME_SLOW)
+                usleep (100000);
+            buf[7] = 1;
+            off = fake_answer (buf, off, i ? "192.0.2.2" : "192.0.2.1");
+        }
+
+        sendto (fd, buf, off, 0, (struct sockaddr *)&from, flen);
+    }
+
+    return NULL;
+}
+
+static int
+lookup (const char *name, const char *want)
+{
+    struct sockaddr_in6 saddrs[HEV_SOCKS5_CONNECT_ADDRS];
+    struct in6_addr addr = { 0 };
+    int family = HEV_SOCKS5_ADDR_FAMILY_IPV4;
+    int n;
+
+    n = hev_socks5_name_into_sockaddr6v (name, 80, saddrs,
+                                         HEV_SOCKS5_CONNECT_ADDRS, &family);
+    if (!want)
+        return n < 0;
+
+    addr.s6_addr[10] = 0xff;
+    addr.s6_addr[11] = 0xff;
+    inet_pton (AF_INET, want, &addr.s6_addr[12]);
+
+    return n == 1 && memcmp (&saddrs[0].sin6_addr, &addr, 16) == 0 &&
+           saddrs[0].sin6_port == htons (80);
+}
+
+static void
+join_entry (void *data)
+{
+    CHECK (lookup ("slow.test", "192.0.2.2"));
+    joined++;
+}
+
+static void
+test_entry (void *data)
+{
+    unsigned int hits, misses, joins;
+    int i;
+
+    CHECK (hev_socks5_set_dns_cache_size (256) < 0);
+
+    /* answers are served from the cache until they expire */
+    CHECK (lookup ("one.test", "192.0.2.1"));
+    CHECK (lookup ("one.test", "192.0.2.1"));
+    CHECK (queries[NAME_ONE] == 1);
+
+    /* NXDOMAIN is cached too */
+    CHECK (lookup ("nx.test", NULL));
+    CHECK (lookup ("nx.test", NULL));
+    CHECK (queries[NAME_NX] == 1);
+
+    /* timeouts are not */
+    CHECK (lookup ("lost.test", NULL));
+    CHECK (lookup ("lost.test", NULL));
+    CHECK (queries[NAME_LOST] == 2);
+
+    /* lookups of a name in flight wait for its query */
+    for (i = 0; i < 3; i++) {
+        HevTask *task = hev_task_new (-1);
+
+        hev_task_run (task, join_entry, NULL);
+    }
+    while (joined < 3)
+        hev_task_sleep (10);
+    CHECK (queries[NAME_SLOW] == 1);
+
+    hev_socks5_get_dns_cache_stats (&hits, &misses, &joins);
+    CHECK (hits == 4);
+    CHECK (misses == 5);
+    CHECK (joins == 2);
+}
+
+int
+main (int argc, char *argv[])
+{
+    struct sockaddr_in addr = { 0 };
+    socklen_t alen = sizeof (addr);
+    pthread_t thread;
+    HevTask *task;
+    int fd;
+
+    fd = socket (AF_INET, SOCK_DGRAM, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    if (fd < 0 || bind (fd, (struct sockaddr *)&addr, alen) < 0 ||
+        getsockname (fd, (struct sockaddr *)&addr, &alen) < 0) {
+        perror ("fake nameserver");
+        return 1;
+    }
+    pthread_create (&thread, NULL, fake_server, &fd);
+
+    hev_socks5_set_dns_native (1);
+    hev_socks5_set_dns_timeout (300, 1);
+    if (hev_socks5_add_dns_nameserver ("127.0.0.1", ntohs (addr.sin_port))) {
+        fprintf (stderr, "add nameserver\n");
+        return 1;
+    }
+    if (hev_socks5_set_dns_cache_size (256)) {
+        fprintf (stderr, "dns cache\n");
+        return 1;
+    }
+
+    hev_task_system_init ();
+    task = hev_task_new (-1);
+    hev_task_run (task, test_entry, NULL);
+    hev_task_system_run ();
+    hev_task_system_fini ();
+
+    if (fails)
+        return 1;
+
+    printf ("dns cache: ok\n");
+    return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-resolver-test.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Resolver Test
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <hev-task.h>
+#include <hev-task-system.h>
+
+#include "hev-socks5.h"
+#include "hev-socks5-misc.h"
+#include "hev-socks5-misc-priv.h"
+#include "hev-socks5-resolver-priv.h"
+
+/*
+ * A fake nameserver on 127.0.0.1 answers by query name:
+ *   both.test     A 192.0.2.1 (TTL 60) and AAAA 2001:db8::1 (TTL 30)
+ *   big.test      A 192.0.2.2 with a TTL above the resolver's cap
+ *   retry.test    drops the first query of each type, answers the next
+ *   mismatch.test sends a reply with the wrong ID before the real one
+ *   nx.test       NXDOMAIN
+ *   other names   never answered
+ */
+
+static int fails;
+static int retry_drops[2];
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            fprintf (stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);    \
+            fails++;                                                       \
+        }                                                                  \
+    } while (0)
+
+static int
+fake_name (const uint8_t *buf, int len, char *name, int size)
+{
+    int off = 12;
+    int n = 0;
+
+    while (off < len && buf[off]) {
+        int l = buf[off++];
+
+        if (off + l > len || n + l + 1 >= size)
+            return -1;
+        if (n)
+            name[n++] = '.';
+        memcpy (&name[n], &buf[off], l);
+        n += l;
+        off += l;
+    }
+
+    name[n] = '\0';
+    return (off + 5 <= len) ? off + 5 : -1;
+}
+
+static int
+fake_answer (uint8_t *buf, int off, int type, uint32_t ttl, const void *rdata)
+{
+    int rdlen = (type == 1) ? 4 : 16;
+
+    buf[off++] = 0xc0; /* pointer to the question name */
+    buf[off++] = 12;
+    buf[off++] = type >> 8;
+    buf[off++] = type;
+    buf[off++] = 0;
+    buf[off++] = 1;
+    buf[off++] = ttl >> 24;
+    buf[off++] = ttl >> 16;
+    buf[off++] = ttl >> 8;
+    buf[off++] = ttl;
+    buf[off++] = 0;
+    buf[off++] = rdlen;
+    memcpy (&buf[off], rdata, rdlen);
+
+    return off + rdlen;
+}
+
+static void *
+fake_server (void *data)
+{
+    int fd = *(int *)data;
+
+    for (;;) {
+        struct sockaddr_in from;
+        socklen_t flen = sizeof (from);
+        struct in_addr a;
+        struct in6_addr aaaa;
+        uint8_t buf[512];
+        char name[256];
+        int len, off, type;
+
+        len = recvfrom (fd, buf, sizeof (buf), 0, (struct sockaddr *)&from,
+                        &flen);
+        if (len < 12)
+            continue;
+
+        off = fake_name (buf, len, name, sizeof (name));
+        if (off < 0)
+            continue;
+        type = (buf[off - 4] << 8) | buf[off - 3];
+
+        buf[2] = 0x81; /* response, recursion desired */
+        buf[3] = 0x80; /* recursion available */
+        buf[6] = 0;
+        buf[7] = 0;
+
+        if (strcmp (name, "both.test") == 0) {
+            buf[7] = 1;
+            if (type == 1) {
+                inet_pton (AF_INET, "192.0.2.1", &a);
+                off = fake_answer (buf, off, type, 60, &a);
+            } else {
+                inet_pton (AF_INET6, "2001:db8::1", &aaaa);
+                off = fake_answer (buf, off, type, 30, &aaaa);
+            }
+        } else if (strcmp (name, "big.test") == 0) {
+            buf[7] = 1;
+            inet_pton (AF_INET, "192.0.2.2", &a);
+            off = fake_answer (buf, off, type, 0x80000000u, &a);
+        } else if (strcmp (name, "retry.test") == 0) {
+            if (!retry_drops[type != 1]++)
+                continue;
+            buf[7] = 1;
+            if (type == 1) {
+                inet_pton (AF_INET, "192.0.2.3", &a);
+                off = fake_answer (buf, off, type, 60, &a);
+            } else {
+                inet_pton (AF_INET6, "2001:db8::3", &aaaa);
+                off = fake_answer (buf, off, type, 60, &aaaa);
+            }
+        } else if (strcmp (name, "mismatch.test") == 0) {
+            buf[7] = 1;
+            inet_pton (AF_INET, "198.51.100.1", &a);
+            off = fake_answer (buf, off, type, 60, &a);
+            buf[0] ^= 0x5a;
+            sendto (fd, buf, off, 0, (struct sockaddr *)&from, flen);
+            buf[0] ^= 0x5a;
+            inet_pton (AF_INET, "192.0.2.4", &a);
+            fake_answer (buf, off - 16, type, 60, &a);
+        } else if (strcmp (name, "nx.test") == 0) {
+            buf[3] |= 3;
+        } else {
+            continue;
+        }
+
+        sendto (fd, buf, off, 0, (struct sockaddr *)&from, flen);
+    }
+
+    return NULL;
+}
+
+static int
+is_addr (const struct in6_addr *addr, const char *str)
+{
+    struct in6_addr want;
+
+    if (strchr (str, ':'))
+        inet_pton (AF_INET6, str, &want);
+    else {
+        memset (&want, 0, 10);
+        want.s6_addr[10] = 0xff;
+        want.s6_addr[11] = 0xff;
+        inet_pton (AF_INET, str, &want.s6_addr[12]);
+    }
+
+    return memcmp (addr, &want, 16) == 0;
+}
+
+static void
+test_entry (void *data)
+{
+    struct in6_addr addrs[HEV_SOCKS5_CONNECT_ADDRS];
+    int64_t start;
+    int n, ttl;
+
+    n = hev_socks5_resolver_query ("both.test", HEV_SOCKS5_ADDR_FAMILY_UNSPEC,
+                                   addrs, HEV_SOCKS5_CONNECT_ADDRS, &ttl);
+    CHECK (n == 2);
+    CHECK (n == 2 && is_addr (&addrs[0], "192.0.2.1"));
+    CHECK (n == 2 && is_addr (&addrs[1], "2001:db8::1"));
+    CHECK (ttl == 30000);
+
+    n = hev_socks5_resolver_query ("both.test", HEV_SOCKS5_ADDR_FAMILY_IPV6,
+                                   addrs, HEV_SOCKS5_CONNECT_ADDRS, &ttl);
+    CHECK (n == 1 && is_addr (&addrs[0], "2001:db8::1"));
+
+    n = hev_socks5_resolver_query ("big.test", HEV_SOCKS5_ADDR_FAMILY_IPV4,
+                                   addrs, HEV_SOCKS5_CONNECT_ADDRS, &ttl);
+    CHECK (n == 1 && is_addr (&addrs[0], "192.0.2.2"));
+    CHECK (ttl == 604800 * 1000);
+
+    start = hev_socks5_now ();
+    n = hev_socks5_resolver_query ("retry.test", HEV_SOCKS5_ADDR_FAMILY_UNSPEC,
+                                   addrs, HEV_SOCKS5_CONNECT_ADDRS, &ttl);
+    CHECK (n == 2);
+    CHECK (n == 2 && is_addr (&addrs[0], "192.0.2.3"));
+    CHECK (n == 2 && is_addr (&addrs[1], "2001:db8::3"));
+    CHECK (hev_socks5_now () - start >= 200);
+
+    n = hev_socks5_resolver_query ("mismatch.test", HEV_SOCKS5_ADDR_FAMILY_IPV4,
+                                   addrs, HEV_SOCKS5_CONNECT_ADDRS, &ttl);
+    CHECK (n == 1 && is_addr (&addrs[0], "192.0.2.4"));
+
+    n = hev_socks5_resolver_query ("nx.test", HEV_SOCKS5_ADDR_FAMILY_UNSPEC,
+                                   addrs, HEV_SOCKS5_CONNECT_ADDRS, &ttl);
+    CHECK (n == 0);
+
+    n = hev_socks5_resolver_query ("lost.test", HEV_SOCKS5_ADDR_FAMILY_UNSPEC,
+                                   addrs, HEV_SOCKS5_CONNECT_ADDRS, &ttl);
+    CHECK (n < 0);
+}
+
+int
+main (int argc, char *argv[])
+{
+    struct sockaddr_in addr = { 0 };
+    socklen_t alen = sizeof (addr);
+    pthread_t thread;
+    HevTask *task;
+    int fd;
+
+    fd = socket (AF_INET, SOCK_DGRAM, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    if (fd < 0 || bind (fd, (struct sockaddr *)&addr, alen) < 0 ||
+        getsockname (fd, (struct sockaddr *)&addr, &alen) < 0) {
+        perror ("fake nameserver");
+        return 1;
+    }
+    pthread_create (&thread, NULL, fake_server, &fd);
+
+    hev_socks5_set_dns_timeout (200, 2);
+    if (hev_socks5_add_dns_nameserver ("127.0.0.1", ntohs (addr.sin_port))) {
+        fprintf (stderr, "add nameserver\n");
+        return 1;
+    }
+
+    hev_task_system_init ();
+    task = hev_task_new (-1);
+    hev_task_run (task, test_entry, NULL);
+    hev_task_system_run ();
+    hev_task_system_fini ();
+
+    if (fails)
+        return 1;
+
+    printf ("resolver: ok\n");
+    return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-tcp-duplex-test.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 TCP Duplex Test
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-system.h>
+
+#include "hev-socks5.h"
+#include "hev-socks5-misc.h"
+#include "hev-socks5-misc-priv.h"
+#include "hev-socks5-server.h"
+
+/*
+ * A server session relays between two socket pairs, its client and its
+ * remote, while both ends send a byte pattern for 1.5 s. That is above the
+ * 1 byte/s threshold for a second, so the relay turns duplex halfway. The
+ * session runs once in-thread and once on the worker pool.
+ */
+
+typedef struct _Flow Flow;
+typedef struct _Session Session;
+
+struct _Flow
+{
+    int fdi;
+    int fdo;
+    size_t sent;
+    size_t recv;
+    int bad;
+};
+
+struct _Session
+{
+    HevSocks5Server *server;
+    int fd;
+    Flow flows[2];
+};
+
+static int fails;
+static int finished;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            fprintf (stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);    \
+            fails++;                                                       \
+        }                                                                  \
+    } while (0)
+
+static void
+send_entry (void *data)
+{
+    Flow *flow = data;
+    HevTask *task = hev_task_self ();
+    int64_t start = hev_socks5_now ();
+
+    hev_task_add_fd (task, flow->fdi, POLLOUT);
+
+    while ((hev_socks5_now () - start) < 1500) {
+        unsigned char buf[4096];
+        ssize_t s;
+        size_t i;
+
+        for (i = 0; i < sizeof (buf); i++)
+            buf[i] = (flow->sent + i) % 251;
+
+        s = hev_task_io_write (flow->fdi, buf, sizeof (buf), NULL, NULL);
+        if (s <= 0)
+            break;
+        flow->sent += s;
+        hev_task_sleep (5);
+    }
+
+    shutdown (flow->fdi, SHUT_WR);
+    hev_task_del_fd (task, flow->fdi);
+}
+
+static void
+recv_entry (void *data)
+{
+    Flow *flow = data;
+    HevTask *task = hev_task_self ();
+
+    hev_task_add_fd (task, flow->fdo, POLLIN);
+
+    for (;;) {
+        unsigned char buf[4096];
+        ssize_t s, i;
+
+        s = hev_task_io_read (flow->fdo, buf, sizeof (buf), NULL, NULL);
+        if (s <= 0)
+            break;
+
+        for (i = 0; i < s; i++)
+            if (buf[i] != (flow->recv + i) % 251)
+                flow->bad++;
+        flow->recv += s;
+    }
+
+    hev_task_del_fd (task, flow->fdo);
+}
+
+static void
+relay_entry (void *data)
+{
+    Session *session = data;
+    HevSocks5Server *server = session->server;
+    HevTask *task = hev_task_self ();
+    int fd = HEV_SOCKS5 (server)->fd;
+
+    hev_task_add_fd (task, fd, POLLIN | POLLOUT);
+    hev_socks5_set_timeout (HEV_SOCKS5 (server), 5000);
+
+    /* owned by the server from here, as in its service */
+    server->fds[0] = session->fd;
+    hev_socks5_tcp_splice (HEV_SOCKS5_TCP (server), session->fd);
+
+    hev_object_unref (HEV_OBJECT (server));
+    finished++;
+}
+
+static void
+flow_entry (void *data)
+{
+    Flow *flow = data;
+    HevTask *task;
+
+    task = hev_task_new (-1);
+    hev_task_run (task, send_entry, flow);
+    recv_entry (flow);
+    finished++;
+}
+
+static void
+session_run (Session *session)
+{
+    int a[2], b[2];
+    int i;
+
+    memset (session, 0, sizeof (Session));
+    finished = 0;
+    CHECK (socketpair (AF_UNIX, SOCK_STREAM, 0, a) == 0);
+    CHECK (socketpair (AF_UNIX, SOCK_STREAM, 0, b) == 0);
+    for (i = 0; i < 2; i++) {
+        fcntl (a[i], F_SETFL, O_NONBLOCK);
+        fcntl (b[i], F_SETFL, O_NONBLOCK);
+    }
+
+    /* the client end reads on a dup, as one task owns each fd */
+    session->flows[0].fdi = a[0];
+    session->flows[0].fdo = b[1];
+    session->flows[1].fdi = dup (b[1]);
+    session->flows[1].fdo = dup (a[0]);
+    session->server = hev_socks5_server_new (a[1]);
+    session->fd = b[0];
+
+    for (i = 0; i < 3; i++) {
+        HevTask *task = hev_task_new (-1);
+
+        if (i < 2)
+            hev_task_run (task, flow_entry, &session->flows[i]);
+        else
+            hev_task_run (task, relay_entry, session);
+    }
+
+    /* the relay ends once both flows are read to EOF */
+    while (finished < 3)
+        hev_task_sleep (10);
+
+    for (i = 0; i < 2; i++) {
+        Flow *flow = &session->flows[i];
+
+        CHECK (flow->sent > 0);
+        CHECK (flow->recv == flow->sent);
+        CHECK (flow->bad == 0);
+        close (flow->fdi);
+        close (flow->fdo);
+    }
+}
+
+static void
+test_entry (void *data)
+{
+    Session session;
+
+    session_run (&session);
+
+    hev_socks5_set_tcp_duplex_threaded (1);
+    session_run (&session);
+}
+
+int
+main (int argc, char *argv[])
+{
+    HevTask *task;
+
+    hev_socks5_set_tcp_duplex_threshold (1);
+    hev_socks5_set_worker_nums (1);
+
+    hev_task_system_init ();
+    task = hev_task_new (-1);
+    hev_task_run (task, test_entry, NULL);
+    hev_task_system_run ();
+    hev_task_system_fini ();
+
+    if (fails)
+        return 1;
+
+    printf ("tcp duplex: ok\n");
+    return 0;
+}